@@ -58,9 +58,11 @@
 #define ALIGNMENT 8
 
 /*
- * Maximum heap size in bytes
+ * Maximum heap size in bytes (a build can set its own with -DMAX_HEAP)
  */
+#ifndef MAX_HEAP
 #define MAX_HEAP (20*(1<<20))  /* 20 MB */
+#endif
 
 /*****************************************************************************
  * Set exactly one of these USE_xxx constants to "1" to select a timing method
@@ -15,6 +15,10 @@
 #include <assert.h>
 #include <float.h>
 #include <time.h>
+#ifdef MM_THREADS
+#include <pthread.h>
+#include <sched.h>
+#endif
 
 #include "mm.h"
 #include "memlib.h"
@@ -29,9 +33,18 @@
 #define MAXLINE     1024 /* max string size */
 #define HDRLINES       4 /* number of header lines in a trace file */
 #define LINENUM(i) (i+5) /* cnvt trace request nums to linenums (origin 1) */
-
-/* Returns true if p is ALIGNMENT-byte aligned */
-#define IS_ALIGNED(p)  ((((unsigned int)(p)) % ALIGNMENT) == 0)
+#define LATRUNS        3 /* replays per trace when measuring per-op latency */
+#define MT_OPS    200000 /* requests per thread in the thread benchmark (-T) */
+#define MT_SLOTS     256 /* live blocks each benchmark thread juggles */
+#define MT_MAXTHREADS 16 /* largest thread count the benchmark runs */
+#define PC_RING     1024 /* blocks in flight between a producer and its consumer (-P) */
+#define PC_MAXPAIRS    8 /* most producer/consumer pairs the pipeline benchmark runs */
+#define MAX_REGIONS   64 /* regions a trace can have open at once */
+#define MAX_POOLS     16 /* pools a trace can use */
+#define CHECK_BUDGET  64 /* blocks and free-list nodes per mm_check_slice (-c) */
+
+/* Returns true if p is a-byte aligned */
+#define IS_ALIGNED(p, a)  ((((unsigned long)(p)) % (a)) == 0)
 
 /****************************** 
  * The key compound data types 
@@ -46,9 +59,15 @@ typedef struct range_t {
 
 /* Characterizes a single trace operation (allocator request) */
 typedef struct {
-    enum {ALLOC, FREE, REALLOC} type; /* type of request */
+    enum {ALLOC, FREE, REALLOC, CALLOC, ALIGNED,
+	  BATCH_ALLOC, BATCH_FREE, REGION_ALLOC, REGION_FREE,
+	  POOL_ALLOC, POOL_FREE} type; /* type of request */
     int index;                        /* index for free() to use later */
-    int size;                         /* byte size of alloc/realloc request */
+    int size;                         /* byte size of alloc/realloc request, or of the block a free releases */
+    int align;                        /* alignment of an ALIGNED request */
+    int count;                        /* ids index..index+count-1 a batch request covers, the
+					 number a region release frees, 1 otherwise */
+    int region;                       /* region of a REGION_* request, or pool of a POOL_* one */
 } traceop_t;
 
 /* Holds the information for one trace file*/
@@ -56,10 +75,12 @@ typedef struct {
     int sugg_heapsize;   /* suggested heap size (unused) */
     int num_ids;         /* number of alloc/realloc ids */
     int num_ops;         /* number of distinct requests */
+    int num_calls;       /* number of blocks the requests allocate or free */
     int weight;          /* weight for this trace (unused) */
     traceop_t *ops;      /* array of requests */
     char **blocks;       /* array of ptrs returned by malloc/realloc... */
     size_t *block_sizes; /* ... and a corresponding array of payload sizes */
+    int *next_id;        /* id allocated before this one in its region, or -1 */
 } trace_t;
 
 /* 
@@ -81,6 +102,11 @@ typedef struct {
 
     /* defined only for the student malloc package */
     double util;     /* space utilization for this trace (always 0 for libc) */
+    double maxlat[3];/* worst-case nsecs of one ALLOC (or CALLOC/ALIGNED), FREE and REALLOC (-w) */
+    double peakheap; /* largest heap plus mapped bytes while running the trace */
+    double endheap;  /* heap plus mapped bytes at the end of the trace */
+    mm_stats_t heap; /* mm_stats at the end of the utilization run */
+    double checksecs;/* secs with mm_check_slice every check_every ops (-c) */
 
     /* Note: secs and util are only defined if valid is true */
 } stats_t; 
@@ -89,6 +115,12 @@ typedef struct {
  * Global variables
  *******************/
 int verbose = 0;        /* global flag for verbose output */
+static int sized_free = 0; /* replay frees with mm_free_sized (-s) */
+static int unbatch = 0; /* replay batch, region and pool requests one block at a time (-u) */
+static int check_every = 0; /* run mm_check_slice every this many ops (-c) */
+static int check_timed = 0; /* eval_mm_speed runs mm_check_slice too */
+static mm_region_t *regions[MAX_REGIONS]; /* regions of the trace being replayed */
+static mm_pool_t *pools[MAX_POOLS]; /* pools of the trace being replayed */
 static int errors = 0;  /* number of errs found when running student malloc */
 char msg[MAXLINE];      /* for whenever we need to compose an error message */
 
@@ -106,9 +138,10 @@ static char *default_tracefiles[] = {
  *********************/
 
 /* these functions manipulate range lists */
-static int add_range(range_t **ranges, char *lo, int size, 
+static int add_range(range_t **ranges, char *lo, int size, int align,
 		     int tracenum, int opnum);
 static void remove_range(range_t **ranges, char *lo);
+static int check_usable(char *p, int size, int tracenum, int opnum);
 static void clear_ranges(range_t **ranges);
 
 /* These functions read, allocate, and free storage for traces */
@@ -122,11 +155,31 @@ static void eval_libc_speed(void *ptr);
 /* Routines for evaluating correctnes, space utilization, and speed 
    of the student's malloc package in mm.c */
 static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges);
-static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges);
+static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges,
+			   mm_stats_t *heap);
 static void eval_mm_speed(void *ptr);
+static void eval_mm_latency(trace_t *trace, double *maxlat);
+static char *trace_calloc(int size);
+static int batch_malloc(int size, int n, char **out);
+static void batch_free(char **ptrs, int n);
+static char *region_malloc(int region, int size);
+static void region_free(trace_t *trace, int region, int index);
+static char *pool_malloc(int pool, int size);
+static void pool_free(int pool, char *p);
+#ifdef MM_THREADS
+static void eval_mm_threads(void);
+static void *mt_worker(void *arg);
+static void eval_mm_pipeline(void);
+static void *pc_producer(void *arg);
+static void *pc_consumer(void *arg);
+#endif
 
 /* Various helper routines */
 static void printresults(int n, stats_t *stats);
+static void printlatency(int n, stats_t *stats);
+static void printheap(int n, stats_t *stats);
+static void printcounters(int n, stats_t *stats);
+static void printcheck(int n, stats_t *stats);
 static void usage(void);
 static void unix_error(char *msg);
 static void malloc_error(int tracenum, int opnum, char *msg);
@@ -150,6 +203,9 @@ int main(int argc, char **argv)
     int team_check = 1;  /* If set, check team structure (reset by -a) */
     int run_libc = 0;    /* If set, run libc malloc (set by -l) */
     int autograder = 0;  /* If set, emit summary info for autograder (-g) */
+    int latency = 0;     /* If set, measure worst-case per-op latency (-w) */
+    int threads = 0;     /* If set, run the thread-scaling benchmark (-T) */
+    int pipeline = 0;    /* If set, run the producer-consumer benchmark (-P) */
 
     /* temporaries used to compute the performance index */
     double secs, ops, util, avg_mm_util, avg_mm_throughput, p1, p2, perfindex;
@@ -158,7 +214,7 @@ int main(int argc, char **argv)
     /* 
      * Read and interpret the command line arguments 
      */
-    while ((c = getopt(argc, argv, "f:t:hvVgal")) != EOF) {
+    while ((c = getopt(argc, argv, "c:f:t:hvVgalwTPsu")) != EOF) {
         switch (c) {
 	case 'g': /* Generate summary info for the autograder */
 	    autograder = 1;
@@ -184,6 +240,27 @@ int main(int argc, char **argv)
         case 'l': /* Run libc malloc */
             run_libc = 1;
             break;
+        case 'w': /* Measure worst-case latency of each mm operation */
+            latency = 1;
+            break;
+        case 's': /* Free with mm_free_sized, passing each block's size */
+            sized_free = 1;
+            break;
+        case 'u': /* Replay batch, region and pool requests with mm_malloc and mm_free */
+            unbatch = 1;
+            break;
+        case 'c': /* Run the incremental heap checker every <n> ops */
+            if ((check_every = atoi(optarg)) <= 0) {
+		usage();
+		exit(1);
+	    }
+            break;
+        case 'T': /* Measure throughput at 1 to MT_MAXTHREADS threads */
+            threads = 1;
+            break;
+        case 'P': /* Measure throughput of producer-consumer pipelines */
+            pipeline = 1;
+            break;
         case 'v': /* Print per-trace performance breakdown */
             verbose = 1;
             break;
@@ -225,6 +302,22 @@ int main(int argc, char **argv)
 	    printf("Member 2 :%s:%s\n", team.name2, team.id2);
     }
 
+    /*
+     * The thread benchmarks replace the trace-driven evaluation
+     */
+    if (threads || pipeline) {
+#ifdef MM_THREADS
+	mem_init();
+	if (threads)
+	    eval_mm_threads();
+	if (pipeline)
+	    eval_mm_pipeline();
+	exit(0);
+#else
+	app_error("-T and -P need the thread-safe driver (make mdriver-mt)");
+#endif
+    }
+
     /* 
      * If no -f command line arg, then use the entire set of tracefiles 
      * defined in default_traces[]
@@ -253,7 +346,7 @@ int main(int argc, char **argv)
 	/* Evaluate the libc malloc package using the K-best scheme */
 	for (i=0; i < num_tracefiles; i++) {
 	    trace = read_trace(tracedir, tracefiles[i]);
-	    libc_stats[i].ops = trace->num_ops;
+	    libc_stats[i].ops = trace->num_calls;
 	    if (verbose > 1)
 		printf("Checking libc malloc for correctness, ");
 	    libc_stats[i].valid = eval_libc_valid(trace, i);
@@ -287,22 +380,39 @@ int main(int argc, char **argv)
     /* Initialize the simulated memory system in memlib.c */
     mem_init(); 
 
+    /* mm_calloc must refuse an nmemb * size that overflows a size_t, both
+       one that wraps to 0 and one that wraps to a small request */
+    if (mm_init() < 0)
+	app_error("mm_init failed.");
+    if (mm_calloc((size_t)-1 / 2 + 1, 2) != NULL ||
+	mm_calloc((size_t)-1 / 8 + 2, 8) != NULL)
+	app_error("mm_calloc did not refuse an nmemb * size that overflows.");
+
     /* Evaluate student's mm malloc package using the K-best scheme */
     for (i=0; i < num_tracefiles; i++) {
 	trace = read_trace(tracedir, tracefiles[i]);
-	mm_stats[i].ops = trace->num_ops;
+	mm_stats[i].ops = trace->num_calls;
 	if (verbose > 1)
 	    printf("Checking mm_malloc for correctness, ");
 	mm_stats[i].valid = eval_mm_valid(trace, i, &ranges);
 	if (mm_stats[i].valid) {
 	    if (verbose > 1)
 		printf("efficiency, ");
-	    mm_stats[i].util = eval_mm_util(trace, i, &ranges);
+	    mm_stats[i].util = eval_mm_util(trace, i, &ranges, &mm_stats[i].heap);
+	    mm_stats[i].peakheap = mem_peak_footprint();
+	    mm_stats[i].endheap = mem_heapsize() + mem_mapsize();
 	    speed_params.trace = trace;
 	    speed_params.ranges = ranges;
 	    if (verbose > 1)
 		printf("and performance.\n");
 	    mm_stats[i].secs = fsecs(eval_mm_speed, &speed_params);
+	    if (check_every) {
+		check_timed = 1;
+		mm_stats[i].checksecs = fsecs(eval_mm_speed, &speed_params);
+		check_timed = 0;
+	    }
+	    if (latency)
+		eval_mm_latency(trace, mm_stats[i].maxlat);
 	}
 	free_trace(trace);
     }
@@ -312,6 +422,23 @@ int main(int argc, char **argv)
 	printf("\nResults for mm malloc:\n");
 	printresults(num_tracefiles, mm_stats);
 	printf("\n");
+	printf("Heap size for mm malloc:\n");
+	printheap(num_tracefiles, mm_stats);
+	printf("\n");
+	printf("Heap counters for mm malloc (mm_stats):\n");
+	printcounters(num_tracefiles, mm_stats);
+	printf("\n");
+    }
+    if (check_every) {
+	printf("\nChecker overhead for mm malloc (-c %d, %d blocks and nodes a slice):\n",
+	       check_every, CHECK_BUDGET);
+	printcheck(num_tracefiles, mm_stats);
+	printf("\n");
+    }
+    if (latency) {
+	printf("\nWorst-case latency for mm malloc:\n");
+	printlatency(num_tracefiles, mm_stats);
+	printf("\n");
     }
 
     /* 
@@ -375,10 +502,11 @@ int main(int argc, char **argv)
 /*
  * add_range - As directed by request opnum in trace tracenum,
  *     we've just called the student's mm_malloc to allocate a block of 
- *     size bytes at addr lo. After checking the block for correctness,
+ *     size bytes at addr lo, aligned to align bytes (ALIGNMENT unless the 
+ *     request asked for more). After checking the block for correctness,
  *     we create a range struct for this block and add it to the range list. 
  */
-static int add_range(range_t **ranges, char *lo, int size, 
+static int add_range(range_t **ranges, char *lo, int size, int align,
 		     int tracenum, int opnum)
 {
     char *hi = lo + size - 1;
@@ -387,17 +515,18 @@ static int add_range(range_t **ranges, char *lo, int size,
 
     assert(size > 0);
 
-    /* Payload addresses must be ALIGNMENT-byte aligned */
-    if (!IS_ALIGNED(lo)) {
+    /* Payload addresses must be ALIGNMENT-byte aligned, or more if asked */
+    if (align < ALIGNMENT)
+	align = ALIGNMENT;
+    if (!IS_ALIGNED(lo, align)) {
 	sprintf(msg, "Payload address (%p) not aligned to %d bytes", 
-		lo, ALIGNMENT);
+		lo, align);
         malloc_error(tracenum, opnum, msg);
         return 0;
     }
 
-    /* The payload must lie within the extent of the heap */
-    if ((lo < (char *)mem_heap_lo()) || (lo > (char *)mem_heap_hi()) || 
-	(hi < (char *)mem_heap_lo()) || (hi > (char *)mem_heap_hi())) {
+    /* The payload must lie within the extent of one arena's heap or one mapping */
+    if (!mem_is_heap(lo, hi) && !mem_is_mapped(lo, hi)) {
 	sprintf(msg, "Payload (%p:%p) lies outside heap (%p:%p)",
 		lo, hi, mem_heap_lo(), mem_heap_hi());
 	malloc_error(tracenum, opnum, msg);
@@ -428,6 +557,27 @@ static int add_range(range_t **ranges, char *lo, int size,
     return 1;
 }
 
+/*
+ * check_usable - As directed by request opnum in trace tracenum, check
+ *     that the block at p, asked to hold size bytes, reports a usable 
+ *     size of at least that much, and no more than the heap or mapping 
+ *     it lies in can hold.
+ */
+static int check_usable(char *p, int size, int tracenum, int opnum)
+{
+    size_t usable = mm_usable_size(p);
+    char msg[MAXLINE];
+
+    if (usable < (size_t)size ||
+	(!mem_is_heap(p, p + usable - 1) && !mem_is_mapped(p, p + usable - 1))) {
+	sprintf(msg, "mm_usable_size (%lu) of payload (%p) is wrong for a "
+		"request of %d bytes", (unsigned long)usable, p, size);
+	malloc_error(tracenum, opnum, msg);
+	return 0;
+    }
+    return 1;
+}
+
 /* 
  * remove_range - Free the range record of block whose payload starts at lo 
  */
@@ -477,7 +627,10 @@ static trace_t *read_trace(char *tracedir, char *filename)
     trace_t *trace;
     char type[MAXLINE];
     char path[MAXLINE];
-    unsigned index, size;
+    unsigned index, size, align, count, k, region;
+    int id;
+    int region_head[MAX_REGIONS];   /* newest id allocated in each region */
+    unsigned pool_size[MAX_POOLS];  /* object size of each pool, 0 until used */
     unsigned max_index = 0;
     unsigned op_index;
 
@@ -514,11 +667,21 @@ static trace_t *read_trace(char *tracedir, char *filename)
     if ((trace->block_sizes = 
 	 (size_t *)malloc(trace->num_ids * sizeof(size_t))) == NULL)
 	unix_error("malloc 4 failed in read_trace");
+
+    /* ... and of the ids each region holds, chained newest first */
+    if ((trace->next_id = 
+	 (int *)malloc(trace->num_ids * sizeof(int))) == NULL)
+	unix_error("malloc 5 failed in read_trace");
+    for (region = 0; region < MAX_REGIONS; region++)
+	region_head[region] = -1;
+    memset(pool_size, 0, sizeof(pool_size));
     
     /* read every request line in the trace file */
     index = 0;
     op_index = 0;
+    trace->num_calls = 0;
     while (fscanf(tracefile, "%s", type) != EOF) {
+	count = 1;
 	switch(type[0]) {
 	case 'a':
 	    fscanf(tracefile, "%u %u", &index, &size);
@@ -527,6 +690,26 @@ static trace_t *read_trace(char *tracedir, char *filename)
 	    trace->ops[op_index].size = size;
 	    max_index = (index > max_index) ? index : max_index;
 	    break;
+	case 'c':
+	    fscanf(tracefile, "%u %u", &index, &size);
+	    trace->ops[op_index].type = CALLOC;
+	    trace->ops[op_index].index = index;
+	    trace->ops[op_index].size = size;
+	    max_index = (index > max_index) ? index : max_index;
+	    break;
+	case 'm':
+	    fscanf(tracefile, "%u %u %u", &index, &size, &align);
+	    if (align == 0 || (align & (align - 1)) != 0) {
+		printf("Alignment %u is not a power of two in tracefile %s\n",
+		       align, path);
+		exit(1);
+	    }
+	    trace->ops[op_index].type = ALIGNED;
+	    trace->ops[op_index].index = index;
+	    trace->ops[op_index].size = size;
+	    trace->ops[op_index].align = align;
+	    max_index = (index > max_index) ? index : max_index;
+	    break;
 	case 'r':
 	    fscanf(tracefile, "%u %u", &index, &size);
 	    trace->ops[op_index].type = REALLOC;
@@ -539,11 +722,103 @@ static trace_t *read_trace(char *tracedir, char *filename)
 	    trace->ops[op_index].type = FREE;
 	    trace->ops[op_index].index = index;
 	    break;
+	case 'A':
+	    fscanf(tracefile, "%u %u %u", &index, &count, &size);
+	    trace->ops[op_index].type = BATCH_ALLOC;
+	    trace->ops[op_index].index = index;
+	    trace->ops[op_index].size = size;
+	    max_index = (index + count - 1 > max_index) ? index + count - 1 : max_index;
+	    break;
+	case 'F':
+	    fscanf(tracefile, "%u %u", &index, &count);
+	    trace->ops[op_index].type = BATCH_FREE;
+	    trace->ops[op_index].index = index;
+	    break;
+	case 'g':
+	case 'G':
+	    if (type[0] == 'g')
+		fscanf(tracefile, "%u %u %u", &index, &region, &size);
+	    else
+		fscanf(tracefile, "%u", &region);
+	    if (region >= MAX_REGIONS) {
+		printf("Region %u is not below %d in tracefile %s\n",
+		       region, MAX_REGIONS, path);
+		exit(1);
+	    }
+	    trace->ops[op_index].region = region;
+	    if (type[0] == 'g') {
+		trace->ops[op_index].type = REGION_ALLOC;
+		trace->ops[op_index].index = index;
+		trace->ops[op_index].size = size;
+		max_index = (index > max_index) ? index : max_index;
+		if (index < (unsigned)trace->num_ids) {
+		    trace->next_id[index] = region_head[region];
+		    region_head[region] = index;
+		}
+		break;
+	    }
+	    
+	    /* A release frees every id given to the region since the last one */
+	    trace->ops[op_index].type = REGION_FREE;
+	    trace->ops[op_index].index = region_head[region];
+	    count = 0;
+	    for (id = region_head[region]; id != -1; id = trace->next_id[id])
+		count++;
+	    region_head[region] = -1;
+	    trace->ops[op_index].count = count;
+	    trace->num_calls += count;
+	    op_index++;
+	    continue;
+	case 'o':
+	case 'O':
+	    if (type[0] == 'o')
+		fscanf(tracefile, "%u %u %u", &index, &region, &size);
+	    else
+		fscanf(tracefile, "%u %u", &index, &region);
+	    if (region >= MAX_POOLS) {
+		printf("Pool %u is not below %d in tracefile %s\n",
+		       region, MAX_POOLS, path);
+		exit(1);
+	    }
+	    trace->ops[op_index].type = (type[0] == 'o') ? POOL_ALLOC : POOL_FREE;
+	    trace->ops[op_index].index = index;
+	    trace->ops[op_index].region = region;
+	    if (type[0] == 'O')
+		break;
+	    
+	    /* Every object of a pool has the size its first one had */
+	    if (pool_size[region] == 0)
+		pool_size[region] = size;
+	    if (size != pool_size[region]) {
+		printf("Pool %u holds %u-byte objects, not %u, in tracefile %s\n",
+		       region, pool_size[region], size, path);
+		exit(1);
+	    }
+	    trace->ops[op_index].size = size;
+	    max_index = (index > max_index) ? index : max_index;
+	    break;
 	default:
 	    printf("Bogus type character (%c) in tracefile %s\n", 
 		   type[0], path);
 	    exit(1);
 	}
+
+	if (count == 0 || index + count > (unsigned)trace->num_ids) {
+	    printf("Request %u touches ids outside 0..%d in tracefile %s\n",
+		   op_index, trace->num_ids - 1, path);
+	    exit(1);
+	}
+	trace->ops[op_index].count = count;
+	trace->num_calls += count;
+
+	/* A free records the size of the block it releases, for -s */
+	if (trace->ops[op_index].type == FREE ||
+	    trace->ops[op_index].type == BATCH_FREE ||
+	    trace->ops[op_index].type == POOL_FREE)
+	    trace->ops[op_index].size = trace->block_sizes[index];
+	else
+	    for (k = index; k < index + count; k++)
+		trace->block_sizes[k] = size;
 	op_index++;
 	
     }
@@ -555,14 +830,15 @@ static trace_t *read_trace(char *tracedir, char *filename)
 }
 
 /*
- * free_trace - Free the trace record and the three arrays it points
+ * free_trace - Free the trace record and the four arrays it points
  *              to, all of which were allocated in read_trace().
  */
 void free_trace(trace_t *trace)
 {
-    free(trace->ops);         /* free the three arrays... */
+    free(trace->ops);         /* free the four arrays... */
     free(trace->blocks);      
     free(trace->block_sizes);
+    free(trace->next_id);
     free(trace);              /* and the trace record itself... */
 }
 
@@ -576,7 +852,7 @@ void free_trace(trace_t *trace)
  */
 static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges) 
 {
-    int i, j;
+    int i, j, k, n;
     int index;
     int size;
     int oldsize;
@@ -593,6 +869,8 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 	malloc_error(tracenum, 0, "mm_init failed.");
 	return 0;
     }
+    memset(regions, 0, sizeof(regions));
+    memset(pools, 0, sizeof(pools));
 
     /* Interpret each operation in the trace in order */
     for (i = 0;  i < trace->num_ops;  i++) {
@@ -602,10 +880,21 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
         switch (trace->ops[i].type) {
 
         case ALLOC: /* mm_malloc */
-
-	    /* Call the student's malloc */
-	    if ((p = mm_malloc(size)) == NULL) {
-		malloc_error(tracenum, i, "mm_malloc failed.");
+        case CALLOC: /* mm_calloc */
+        case ALIGNED: /* mm_memalign */
+
+	    /* Call the student's malloc, calloc or memalign */
+	    if (trace->ops[i].type == CALLOC)
+		p = trace_calloc(size);
+	    else if (trace->ops[i].type == ALIGNED)
+		p = mm_memalign(trace->ops[i].align, size);
+	    else
+		p = mm_malloc(size);
+	    if (p == NULL) {
+		malloc_error(tracenum, i, (trace->ops[i].type == CALLOC) ?
+			     "mm_calloc failed." : 
+			     (trace->ops[i].type == ALIGNED) ?
+			     "mm_memalign failed." : "mm_malloc failed.");
 		return 0;
 	    }
 	    
@@ -614,15 +903,30 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 	     * to the range list if OK. The block must be  be aligned properly,
 	     * and must not overlap any currently allocated block. 
 	     */ 
-	    if (add_range(ranges, p, size, tracenum, i) == 0)
+	    if (add_range(ranges, p, size, (trace->ops[i].type == ALIGNED) ?
+			  trace->ops[i].align : ALIGNMENT, tracenum, i) == 0)
 		return 0;
 	    
+	    /* A calloc'd block must read as all zeroes */
+	    if (trace->ops[i].type == CALLOC) {
+		for (j = 0; j < size; j++) {
+		    if (p[j] != 0) {
+			malloc_error(tracenum, i, "mm_calloc did not zero the block");
+			return 0;
+		    }
+		}
+	    }
+	    
+	    /* The whole usable size must be ours to write, slack included */
+	    if (!check_usable(p, size, tracenum, i))
+		return 0;
+
 	    /* ADDED: cgw
 	     * fill range with low byte of index.  This will be used later
 	     * if we realloc the block and wish to make sure that the old
 	     * data was copied to the new block
 	     */
-	    memset(p, index & 0xFF, size);
+	    memset(p, index & 0xFF, mm_usable_size(p));
 
 	    /* Remember region */
 	    trace->blocks[index] = p;
@@ -642,7 +946,7 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 	    remove_range(ranges, oldp);
 	    
 	    /* Check new block for correctness and add it to range list */
-	    if (add_range(ranges, newp, size, tracenum, i) == 0)
+	    if (add_range(ranges, newp, size, ALIGNMENT, tracenum, i) == 0)
 		return 0;
 	    
 	    /* ADDED: cgw
@@ -659,7 +963,9 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 		return 0;
 	      }
 	    }
-	    memset(newp, index & 0xFF, size);
+	    if (!check_usable(newp, size, tracenum, i))
+		return 0;
+	    memset(newp, index & 0xFF, mm_usable_size(newp));
 
 	    /* Remember region */
 	    trace->blocks[index] = newp;
@@ -671,13 +977,86 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 	    /* Remove region from list and call student's free function */
 	    p = trace->blocks[index];
 	    remove_range(ranges, p);
-	    mm_free(p);
+	    if (sized_free)
+		mm_free_sized(p, size);
+	    else
+		mm_free(p);
+	    break;
+
+        case BATCH_ALLOC: /* mm_malloc_batch */
+	    
+	    /* Every block of the batch is checked like a single malloc's */
+	    n = trace->ops[i].count;
+	    if (batch_malloc(size, n, trace->blocks + index) != n) {
+		malloc_error(tracenum, i, "mm_malloc_batch failed.");
+		return 0;
+	    }
+	    for (k = index; k < index + n; k++) {
+		p = trace->blocks[k];
+		if (add_range(ranges, p, size, ALIGNMENT, tracenum, i) == 0)
+		    return 0;
+		if (!check_usable(p, size, tracenum, i))
+		    return 0;
+		memset(p, k & 0xFF, mm_usable_size(p));
+		trace->block_sizes[k] = size;
+	    }
+	    break;
+
+        case BATCH_FREE: /* mm_free_batch */
+	    n = trace->ops[i].count;
+	    for (k = index; k < index + n; k++)
+		remove_range(ranges, trace->blocks[k]);
+	    batch_free(trace->blocks + index, n);
+	    break;
+
+        case REGION_ALLOC: /* mm_region_alloc */
+	    
+	    /* Region objects have no usable size of their own to check */
+	    if ((p = region_malloc(trace->ops[i].region, size)) == NULL) {
+		malloc_error(tracenum, i, "mm_region_alloc failed.");
+		return 0;
+	    }
+	    if (add_range(ranges, p, size, ALIGNMENT, tracenum, i) == 0)
+		return 0;
+	    memset(p, index & 0xFF, size);
+	    trace->blocks[index] = p;
+	    trace->block_sizes[index] = size;
+	    break;
+
+        case REGION_FREE: /* mm_region_reset */
+	    for (k = index; k != -1; k = trace->next_id[k])
+		remove_range(ranges, trace->blocks[k]);
+	    region_free(trace, trace->ops[i].region, index);
+	    break;
+
+        case POOL_ALLOC: /* mm_pool_get */
+	    if ((p = pool_malloc(trace->ops[i].region, size)) == NULL) {
+		malloc_error(tracenum, i, "mm_pool_get failed.");
+		return 0;
+	    }
+	    if (add_range(ranges, p, size, ALIGNMENT, tracenum, i) == 0)
+		return 0;
+	    memset(p, index & 0xFF, size);
+	    trace->blocks[index] = p;
+	    trace->block_sizes[index] = size;
+	    break;
+
+        case POOL_FREE: /* mm_pool_put */
+	    p = trace->blocks[index];
+	    remove_range(ranges, p);
+	    pool_free(trace->ops[i].region, p);
 	    break;
 
 	default:
 	    app_error("Nonexistent request type in eval_mm_valid");
         }
 
+	/* Check the next slice of the heap every check_every ops (-c) */
+	if (check_every && (i + 1) % check_every == 0 && 
+	    mm_check_slice(CHECK_BUDGET) < 0) {
+	    malloc_error(tracenum, i, "mm_check_slice found the heap inconsistent.");
+	    return 0;
+	}
     }
 
     /* As far as we know, this is a valid malloc package */
@@ -689,15 +1068,18 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
  *   The idea is to remember the high water mark "hwm" of the heap for 
  *   an optimal allocator, i.e., no gaps and no internal fragmentation.
  *   Utilization is the ratio hwm/heapsize, where heapsize is the 
- *   size of the heap in bytes after running the student's malloc 
- *   package on the trace. Note that our implementation of mem_sbrk() 
- *   doesn't allow the students to decrement the brk pointer, so brk
- *   is always the high water mark of the heap. 
+ *   peak size of the heap in bytes while running the student's malloc 
+ *   package on the trace, counting any regions mapped with mem_map() 
+ *   as part of the heap. Since mem_sbrk() lets the students decrement 
+ *   the brk pointer and mappings can be released, the final footprint 
+ *   can be lower than its high water mark, so memlib tracks the peak 
+ *   separately. 
  *   
  */
-static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
+static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges,
+			   mm_stats_t *heap)
 {   
-    int i;
+    int i, k, n;
     int index;
     int size, newsize, oldsize;
     int max_total_size = 0;
@@ -709,15 +1091,25 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
     mem_reset_brk();
     if (mm_init() < 0)
 	app_error("mm_init failed in eval_mm_util");
+    memset(regions, 0, sizeof(regions));
+    memset(pools, 0, sizeof(pools));
 
     for (i = 0;  i < trace->num_ops;  i++) {
         switch (trace->ops[i].type) {
 
         case ALLOC: /* mm_alloc */
+        case CALLOC: /* mm_calloc */
+        case ALIGNED: /* mm_memalign */
 	    index = trace->ops[i].index;
 	    size = trace->ops[i].size;
 
-	    if ((p = mm_malloc(size)) == NULL) 
+	    if (trace->ops[i].type == CALLOC)
+		p = trace_calloc(size);
+	    else if (trace->ops[i].type == ALIGNED)
+		p = mm_memalign(trace->ops[i].align, size);
+	    else
+		p = mm_malloc(size);
+	    if (p == NULL) 
 		app_error("mm_malloc failed in eval_mm_util");
 	    
 	    /* Remember region and size */
@@ -760,7 +1152,10 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
 	    size = trace->block_sizes[index];
 	    p = trace->blocks[index];
 	    
-	    mm_free(p);
+	    if (sized_free)
+		mm_free_sized(p, size);
+	    else
+		mm_free(p);
 	    
 	    /* Keep track of current total size
 	     * of all allocated blocks */
@@ -768,13 +1163,72 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
 	    
 	    break;
 
+        case BATCH_ALLOC: /* mm_malloc_batch */
+	    index = trace->ops[i].index;
+	    size = trace->ops[i].size;
+	    n = trace->ops[i].count;
+	    if (batch_malloc(size, n, trace->blocks + index) != n)
+		app_error("mm_malloc_batch failed in eval_mm_util");
+	    for (k = index; k < index + n; k++)
+		trace->block_sizes[k] = size;
+	    total_size += n * size;
+	    max_total_size = (total_size > max_total_size) ?
+		total_size : max_total_size;
+	    break;
+
+        case BATCH_FREE: /* mm_free_batch */
+	    index = trace->ops[i].index;
+	    n = trace->ops[i].count;
+	    batch_free(trace->blocks + index, n);
+	    for (k = index; k < index + n; k++)
+		total_size -= trace->block_sizes[k];
+	    break;
+
+        case REGION_ALLOC: /* mm_region_alloc */
+	    index = trace->ops[i].index;
+	    size = trace->ops[i].size;
+	    if ((p = region_malloc(trace->ops[i].region, size)) == NULL)
+		app_error("mm_region_alloc failed in eval_mm_util");
+	    trace->blocks[index] = p;
+	    trace->block_sizes[index] = size;
+	    total_size += size;
+	    max_total_size = (total_size > max_total_size) ?
+		total_size : max_total_size;
+	    break;
+
+        case REGION_FREE: /* mm_region_reset */
+	    index = trace->ops[i].index;
+	    region_free(trace, trace->ops[i].region, index);
+	    for (k = index; k != -1; k = trace->next_id[k])
+		total_size -= trace->block_sizes[k];
+	    break;
+
+        case POOL_ALLOC: /* mm_pool_get */
+	    index = trace->ops[i].index;
+	    size = trace->ops[i].size;
+	    if ((p = pool_malloc(trace->ops[i].region, size)) == NULL)
+		app_error("mm_pool_get failed in eval_mm_util");
+	    trace->blocks[index] = p;
+	    trace->block_sizes[index] = size;
+	    total_size += size;
+	    max_total_size = (total_size > max_total_size) ?
+		total_size : max_total_size;
+	    break;
+
+        case POOL_FREE: /* mm_pool_put */
+	    index = trace->ops[i].index;
+	    pool_free(trace->ops[i].region, trace->blocks[index]);
+	    total_size -= trace->block_sizes[index];
+	    break;
+
 	default:
 	    app_error("Nonexistent request type in eval_mm_util");
 
         }
     }
 
-    return ((double)max_total_size / (double)mem_heapsize());
+    mm_stats(heap);
+    return ((double)max_total_size / (double)mem_peak_footprint());
 }
 
 
@@ -792,9 +1246,11 @@ static void eval_mm_speed(void *ptr)
     mem_reset_brk();
     if (mm_init() < 0) 
 	app_error("mm_init failed in eval_mm_speed");
+    memset(regions, 0, sizeof(regions));
+    memset(pools, 0, sizeof(pools));
 
     /* Interpret each trace request */
-    for (i = 0;  i < trace->num_ops;  i++)
+    for (i = 0;  i < trace->num_ops;  i++) {
         switch (trace->ops[i].type) {
 
         case ALLOC: /* mm_malloc */
@@ -805,6 +1261,22 @@ static void eval_mm_speed(void *ptr)
             trace->blocks[index] = p;
             break;
 
+        case CALLOC: /* mm_calloc */
+            index = trace->ops[i].index;
+            size = trace->ops[i].size;
+            if ((p = trace_calloc(size)) == NULL)
+		app_error("mm_calloc error in eval_mm_speed");
+            trace->blocks[index] = p;
+            break;
+
+        case ALIGNED: /* mm_memalign */
+            index = trace->ops[i].index;
+            size = trace->ops[i].size;
+            if ((p = mm_memalign(trace->ops[i].align, size)) == NULL)
+		app_error("mm_memalign error in eval_mm_speed");
+            trace->blocks[index] = p;
+            break;
+
 	case REALLOC: /* mm_realloc */
 	    index = trace->ops[i].index;
             newsize = trace->ops[i].size;
@@ -817,12 +1289,501 @@ static void eval_mm_speed(void *ptr)
         case FREE: /* mm_free */
             index = trace->ops[i].index;
             block = trace->blocks[index];
-            mm_free(block);
+            if (sized_free)
+		mm_free_sized(block, trace->ops[i].size);
+            else
+		mm_free(block);
+            break;
+
+        case BATCH_ALLOC: /* mm_malloc_batch */
+            index = trace->ops[i].index;
+            if (batch_malloc(trace->ops[i].size, trace->ops[i].count,
+			     trace->blocks + index) != trace->ops[i].count)
+		app_error("mm_malloc_batch error in eval_mm_speed");
+            break;
+
+        case BATCH_FREE: /* mm_free_batch */
+            index = trace->ops[i].index;
+            batch_free(trace->blocks + index, trace->ops[i].count);
+            break;
+
+        case REGION_ALLOC: /* mm_region_alloc */
+            index = trace->ops[i].index;
+            if ((p = region_malloc(trace->ops[i].region, trace->ops[i].size)) == NULL)
+		app_error("mm_region_alloc error in eval_mm_speed");
+            trace->blocks[index] = p;
+            break;
+
+        case REGION_FREE: /* mm_region_reset */
+            region_free(trace, trace->ops[i].region, trace->ops[i].index);
+            break;
+
+        case POOL_ALLOC: /* mm_pool_get */
+            index = trace->ops[i].index;
+            if ((p = pool_malloc(trace->ops[i].region, trace->ops[i].size)) == NULL)
+		app_error("mm_pool_get error in eval_mm_speed");
+            trace->blocks[index] = p;
+            break;
+
+        case POOL_FREE: /* mm_pool_put */
+            index = trace->ops[i].index;
+            pool_free(trace->ops[i].region, trace->blocks[index]);
             break;
 
 	default:
 	    app_error("Nonexistent request type in eval_mm_valid");
         }
+
+	/* Charge the checker to the trace when measuring its overhead (-c) */
+	if (check_timed && (i + 1) % check_every == 0)
+	    mm_check_slice(CHECK_BUDGET);
+    }
+}
+
+#ifdef MM_THREADS
+/* Per-thread arguments and results for the thread benchmark */
+typedef struct {
+    int id;       /* thread number, seeds its request stream */
+    int errors;   /* allocation failures and corrupted payloads seen */
+} mt_arg_t;
+
+/*
+ * mt_worker - Issue MT_OPS requests against MT_SLOTS slots. An empty slot 
+ *    gets a new block, mostly of 8-128 bytes with an occasional one of up 
+ *    to 1KB; a full slot is checked for its tag byte and freed.
+ */
+static void *mt_worker(void *arg)
+{
+    mt_arg_t *a = (mt_arg_t *)arg;
+    char *slots[MT_SLOTS];
+    size_t size;
+    unsigned int seed = 2463534242U + 7919 * a->id;
+    int i, k;
+
+    memset(slots, 0, sizeof(slots));
+    for (i = 0; i < MT_OPS; i++) {
+	seed ^= seed << 13;
+	seed ^= seed >> 17;
+	seed ^= seed << 5;
+	k = seed % MT_SLOTS;
+	if (slots[k] != NULL) {
+	    if (*slots[k] != (char)(k ^ a->id))
+		a->errors++;
+	    mm_free(slots[k]);
+	    slots[k] = NULL;
+	}
+	else {
+	    size = ((seed >> 8) & 15) ? 8 + (seed >> 12) % 121 : 8 + (seed >> 12) % 1017;
+	    if ((slots[k] = mm_malloc(size)) == NULL) {
+		a->errors++;
+		continue;
+	    }
+	    memset(slots[k], k ^ a->id, size);
+	}
+    }
+    for (k = 0; k < MT_SLOTS; k++)
+	if (slots[k] != NULL)
+	    mm_free(slots[k]);
+    return NULL;
+}
+
+/*
+ * eval_mm_threads - Run mt_worker on 1, 2, 4, 8 and 16 threads at once 
+ *    over a fresh heap, and print the aggregate throughput of each run 
+ *    and its speedup over the single-threaded run, then the per-arena 
+ *    and per-bin counters of the last run.
+ */
+static void eval_mm_threads(void)
+{
+    pthread_t tid[MT_MAXTHREADS];
+    mt_arg_t args[MT_MAXTHREADS];
+    struct timespec t0, t1;
+    mm_arena_stats_t st;
+    mm_bin_stats_t bst;
+    double secs, kops, base = 0;
+    int n, i, errs;
+
+    printf("\nThread scaling for mm malloc:\n");
+    printf("%7s%10s%10s%9s\n", "threads", "secs", "Kops", "speedup");
+    for (n = 1; n <= MT_MAXTHREADS; n *= 2) {
+	mem_reset_brk();
+	if (mm_init() < 0)
+	    app_error("mm_init failed in eval_mm_threads");
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for (i = 0; i < n; i++) {
+	    args[i].id = i;
+	    args[i].errors = 0;
+	    if (pthread_create(&tid[i], NULL, mt_worker, &args[i]) != 0)
+		unix_error("pthread_create failed in eval_mm_threads");
+	}
+	for (errs = 0, i = 0; i < n; i++) {
+	    pthread_join(tid[i], NULL);
+	    errs += args[i].errors;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+
+	if (errs != 0) {
+	    sprintf(msg, "%d failed or corrupted requests at %d threads", errs, n);
+	    app_error(msg);
+	}
+	secs = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+	kops = (double)n * MT_OPS / 1e3 / secs;
+	if (n == 1)
+	    base = kops;
+	printf("%7d%10.4f%10.0f%8.2fx\n", n, secs, kops, kops / base);
+    }
+
+    /* How the last run spread over the arenas */
+    printf("\nArenas after %d threads:\n", MT_MAXTHREADS);
+    printf("%7s%10s%10s%10s%11s\n", "arena", "heap", "mallocs", "frees", "contended");
+    for (i = 0; i < mm_arena_count(); i++) {
+	mm_arena_stats(i, &st);
+	printf("%7d%10lu%10lu%10lu%11lu\n", i, (unsigned long)st.heapsize,
+	       (unsigned long)st.mallocs, (unsigned long)st.frees,
+	       (unsigned long)st.contended);
+    }
+
+    /* And where they collided, in builds that lock each bin */
+    if (mm_bin_count() > 0) {
+	printf("\nBins after %d threads:\n", MT_MAXTHREADS);
+	printf("%7s%10s%10s%10s\n", "size", "acquires", "spins", "sleeps");
+	for (i = 0; i < mm_bin_count(); i++) {
+	    mm_bin_stats(i, &bst);
+	    printf("%7lu%10lu%10lu%10lu\n", (unsigned long)bst.objsize,
+		   (unsigned long)bst.acquires, (unsigned long)bst.spins,
+		   (unsigned long)bst.sleeps);
+	}
+    }
+}
+
+/* A single-producer, single-consumer ring of blocks plus its pipeline's results */
+typedef struct {
+    char *ring[PC_RING];
+    unsigned int head;   /* next slot the producer fills, written by the producer only */
+    unsigned int tail;   /* next slot the consumer empties, written by the consumer only */
+    int id;              /* pipeline number, seeds the request sizes */
+    int errors;          /* failed allocations and corrupted payloads, counted by the consumer */
+} pc_pipe_t;
+
+/*
+ * pc_producer - Allocate MT_OPS blocks of 8-1024 bytes, tag each with 
+ *    its sequence number, and hand them to the consumer through the ring.
+ *    A failed allocation is passed on as NULL.
+ */
+static void *pc_producer(void *arg)
+{
+    pc_pipe_t *p = (pc_pipe_t *)arg;
+    unsigned int seed = 2463534242U + 7919 * p->id;
+    unsigned int head;
+    size_t size;
+    char *bp;
+    int i;
+
+    for (i = 0; i < MT_OPS; i++) {
+	seed ^= seed << 13;
+	seed ^= seed >> 17;
+	seed ^= seed << 5;
+	size = ((seed >> 8) & 15) ? 8 + (seed >> 12) % 121 : 8 + (seed >> 12) % 1017;
+	if ((bp = mm_malloc(size)) != NULL)
+	    memset(bp, (char)i, size);
+
+	head = p->head;
+	while (head - __atomic_load_n(&p->tail, __ATOMIC_ACQUIRE) == PC_RING)
+	    sched_yield();
+	p->ring[head % PC_RING] = bp;
+	__atomic_store_n(&p->head, head + 1, __ATOMIC_RELEASE);
+    }
+    return NULL;
+}
+
+/*
+ * pc_consumer - Take MT_OPS blocks off the ring, check each one's tag,
+ *    and free it.
+ */
+static void *pc_consumer(void *arg)
+{
+    pc_pipe_t *p = (pc_pipe_t *)arg;
+    unsigned int tail;
+    char *bp;
+    int i;
+
+    for (i = 0; i < MT_OPS; i++) {
+	tail = p->tail;
+	while (__atomic_load_n(&p->head, __ATOMIC_ACQUIRE) == tail)
+	    sched_yield();
+	bp = p->ring[tail % PC_RING];
+	__atomic_store_n(&p->tail, tail + 1, __ATOMIC_RELEASE);
+	if (bp == NULL || *bp != (char)i)
+	    p->errors++;
+	if (bp != NULL)
+	    mm_free(bp);
+    }
+    return NULL;
+}
+
+/*
+ * eval_mm_pipeline - Run 1, 2, 4 and 8 producer/consumer pairs at once 
+ *    over a fresh heap, where every block is allocated by one thread and 
+ *    freed by another, and print the aggregate throughput of each run 
+ *    and how many frees went through the arenas' remote-free queues.
+ */
+static void eval_mm_pipeline(void)
+{
+    pthread_t prod[PC_MAXPAIRS], cons[PC_MAXPAIRS];
+    static pc_pipe_t pipes[PC_MAXPAIRS];
+    mm_arena_stats_t st;
+    struct timespec t0, t1;
+    double secs, kops;
+    unsigned long remote;
+    int n, i, errs;
+
+    printf("\nProducer-consumer pipelines for mm malloc:\n");
+    printf("%7s%10s%10s%10s\n", "pairs", "secs", "Kops", "remote");
+    for (n = 1; n <= PC_MAXPAIRS; n *= 2) {
+	mem_reset_brk();
+	if (mm_init() < 0)
+	    app_error("mm_init failed in eval_mm_pipeline");
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for (i = 0; i < n; i++) {
+	    memset(&pipes[i], 0, sizeof(pipes[i]));
+	    pipes[i].id = i;
+	    if (pthread_create(&prod[i], NULL, pc_producer, &pipes[i]) != 0 ||
+		pthread_create(&cons[i], NULL, pc_consumer, &pipes[i]) != 0)
+		unix_error("pthread_create failed in eval_mm_pipeline");
+	}
+	for (errs = 0, i = 0; i < n; i++) {
+	    pthread_join(prod[i], NULL);
+	    pthread_join(cons[i], NULL);
+	    errs += pipes[i].errors;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+
+	if (errs != 0) {
+	    sprintf(msg, "%d failed or corrupted requests at %d pairs", errs, n);
+	    app_error(msg);
+	}
+	for (remote = 0, i = 0; i < mm_arena_count(); i++) {
+	    mm_arena_stats(i, &st);
+	    remote += st.remote_frees;
+	}
+	secs = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+	kops = 2.0 * n * MT_OPS / 1e3 / secs;
+	printf("%7d%10.4f%10.0f%10lu\n", n, secs, kops, remote);
+    }
+}
+#endif
+
+/*
+ * eval_mm_latency - Replay the trace LATRUNS times, timing every request
+ *    individually, and record the worst single malloc, free, and realloc.
+ *    Taking the smallest worst case over the replays filters out one-off
+ *    interrupts and page faults that have nothing to do with mm.c.
+ */
+static void eval_mm_latency(trace_t *trace, double *maxlat)
+{
+    int i, run, index, size;
+    int type;
+    char *p;
+    double ns;
+    double runmax[3];
+    struct timespec t0, t1;
+
+    for (type = 0; type < 3; type++)
+	maxlat[type] = DBL_MAX;
+
+    for (run = 0; run < LATRUNS; run++) {
+	mem_reset_brk();
+	if (mm_init() < 0)
+	    app_error("mm_init failed in eval_mm_latency");
+	memset(regions, 0, sizeof(regions));
+	memset(pools, 0, sizeof(pools));
+	runmax[ALLOC] = runmax[FREE] = runmax[REALLOC] = 0;
+
+	for (i = 0;  i < trace->num_ops;  i++) {
+	    index = trace->ops[i].index;
+	    size = trace->ops[i].size;
+	    type = trace->ops[i].type;
+
+	    clock_gettime(CLOCK_MONOTONIC, &t0);
+	    switch (type) {
+	    case ALLOC:
+		p = mm_malloc(size);
+		break;
+	    case CALLOC:
+		p = trace_calloc(size);
+		type = ALLOC;   /* reported along with malloc */
+		break;
+	    case ALIGNED:
+		p = mm_memalign(trace->ops[i].align, size);
+		type = ALLOC;   /* reported along with malloc */
+		break;
+	    case REALLOC:
+		p = mm_realloc(trace->blocks[index], size);
+		break;
+	    case FREE:
+		if (sized_free)
+		    mm_free_sized(trace->blocks[index], size);
+		else
+		    mm_free(trace->blocks[index]);
+		p = NULL;
+		break;
+	    case BATCH_ALLOC:
+		if (batch_malloc(size, trace->ops[i].count, trace->blocks + index)
+		    != trace->ops[i].count)
+		    app_error("mm_malloc_batch error in eval_mm_latency");
+		p = trace->blocks[index];
+		type = ALLOC;
+		break;
+	    case BATCH_FREE:
+		batch_free(trace->blocks + index, trace->ops[i].count);
+		p = NULL;
+		type = FREE;
+		break;
+	    case REGION_ALLOC:
+		p = region_malloc(trace->ops[i].region, size);
+		type = ALLOC;
+		break;
+	    case REGION_FREE:
+		region_free(trace, trace->ops[i].region, index);
+		p = NULL;
+		type = FREE;
+		break;
+	    case POOL_ALLOC:
+		p = pool_malloc(trace->ops[i].region, size);
+		type = ALLOC;
+		break;
+	    case POOL_FREE:
+		pool_free(trace->ops[i].region, trace->blocks[index]);
+		p = NULL;
+		type = FREE;
+		break;
+	    default:
+		app_error("Nonexistent request type in eval_mm_latency");
+	    }
+	    clock_gettime(CLOCK_MONOTONIC, &t1);
+
+	    if (type != FREE) {
+		if (p == NULL)
+		    app_error("mm_malloc error in eval_mm_latency");
+		trace->blocks[index] = p;
+	    }
+	    /* A batch is charged as that many requests of equal cost */
+	    ns = (t1.tv_sec - t0.tv_sec) * 1e9 + (t1.tv_nsec - t0.tv_nsec);
+	    if (trace->ops[i].count > 1)
+		ns /= trace->ops[i].count;
+	    if (ns > runmax[type])
+		runmax[type] = ns;
+	}
+
+	for (type = 0; type < 3; type++)
+	    if (runmax[type] < maxlat[type])
+		maxlat[type] = runmax[type];
+    }
+}
+
+/*
+ * trace_calloc - Allocate a zeroed block of size bytes with mm_calloc,
+ *    split into as many as 8 elements when size divides evenly, so the
+ *    package has to multiply nmemb by size itself.
+ */
+static char *trace_calloc(int size)
+{
+    int n;
+
+    for (n = 8; n > 1; n /= 2)
+	if (size % n == 0)
+	    break;
+    return mm_calloc(n, size / n);
+}
+
+/*
+ * batch_malloc - Allocate n blocks of size bytes into out with
+ *    mm_malloc_batch, or with n calls to mm_malloc under -u, so the two
+ *    can be compared on the same trace. Returns how many it allocated.
+ */
+static int batch_malloc(int size, int n, char **out)
+{
+    int k;
+
+    if (!unbatch)
+	return (int)mm_malloc_batch(size, n, (void **)out);
+    for (k = 0; k < n; k++)
+	if ((out[k] = mm_malloc(size)) == NULL)
+	    break;
+    return k;
+}
+
+/*
+ * batch_free - Free the n blocks in ptrs with mm_free_batch, or with n
+ *    calls to mm_free under -u.
+ */
+static void batch_free(char **ptrs, int n)
+{
+    int k;
+
+    if (!unbatch) {
+	mm_free_batch((void **)ptrs, n);
+	return;
+    }
+    for (k = 0; k < n; k++)
+	mm_free(ptrs[k]);
+}
+
+/*
+ * region_malloc - Allocate size bytes from the given region, creating it
+ *    on first use, or with mm_malloc under -u.
+ */
+static char *region_malloc(int region, int size)
+{
+    if (unbatch)
+	return mm_malloc(size);
+    if (regions[region] == NULL && (regions[region] = mm_region_create()) == NULL)
+	return NULL;
+    return mm_region_alloc(regions[region], size);
+}
+
+/*
+ * region_free - Release a region by resetting it, or under -u by freeing
+ *    its blocks one at a time, starting with id index and following the
+ *    chain read_trace built.
+ */
+static void region_free(trace_t *trace, int region, int index)
+{
+    int k;
+
+    if (!unbatch) {
+	if (regions[region] != NULL)
+	    mm_region_reset(regions[region]);
+	return;
+    }
+    for (k = index; k != -1; k = trace->next_id[k])
+	mm_free(trace->blocks[k]);
+}
+
+/*
+ * pool_malloc - Take a size-byte object from the given pool, creating it
+ *    on first use, or allocate it with mm_malloc under -u.
+ */
+static char *pool_malloc(int pool, int size)
+{
+    if (unbatch)
+	return mm_malloc(size);
+    if (pools[pool] == NULL && (pools[pool] = mm_pool_create(size)) == NULL)
+	return NULL;
+    return mm_pool_get(pools[pool]);
+}
+
+/*
+ * pool_free - Put p back in its pool, or free it with mm_free under -u.
+ */
+static void pool_free(int pool, char *p)
+{
+    if (unbatch)
+	mm_free(p);
+    else
+	mm_pool_put(pools[pool], p);
 }
 
 /*
@@ -833,7 +1794,7 @@ static void eval_mm_speed(void *ptr)
  */
 static int eval_libc_valid(trace_t *trace, int tracenum)
 {
-    int i, newsize;
+    int i, k, newsize;
     char *p, *newp, *oldp;
 
     for (i = 0;  i < trace->num_ops;  i++) {
@@ -847,6 +1808,22 @@ static int eval_libc_valid(trace_t *trace, int tracenum)
 	    trace->blocks[trace->ops[i].index] = p;
 	    break;
 
+        case CALLOC: /* calloc */
+	    if ((p = calloc(1, trace->ops[i].size)) == NULL) {
+		malloc_error(tracenum, i, "libc calloc failed");
+		unix_error("System message");
+	    }
+	    trace->blocks[trace->ops[i].index] = p;
+	    break;
+
+        case ALIGNED: /* aligned_alloc */
+	    if ((p = aligned_alloc(trace->ops[i].align, trace->ops[i].size)) == NULL) {
+		malloc_error(tracenum, i, "libc aligned_alloc failed");
+		unix_error("System message");
+	    }
+	    trace->blocks[trace->ops[i].index] = p;
+	    break;
+
 	case REALLOC: /* realloc */
             newsize = trace->ops[i].size;
 	    oldp = trace->blocks[trace->ops[i].index];
@@ -861,6 +1838,39 @@ static int eval_libc_valid(trace_t *trace, int tracenum)
 	    free(trace->blocks[trace->ops[i].index]);
 	    break;
 
+        case BATCH_ALLOC: /* malloc, once per block */
+	    for (k = 0; k < trace->ops[i].count; k++) {
+		if ((p = malloc(trace->ops[i].size)) == NULL) {
+		    malloc_error(tracenum, i, "libc malloc failed");
+		    unix_error("System message");
+		}
+		trace->blocks[trace->ops[i].index + k] = p;
+	    }
+	    break;
+
+        case BATCH_FREE: /* free, once per block */
+	    for (k = 0; k < trace->ops[i].count; k++)
+		free(trace->blocks[trace->ops[i].index + k]);
+	    break;
+
+        case REGION_ALLOC: /* malloc */
+        case POOL_ALLOC: /* malloc */
+	    if ((p = malloc(trace->ops[i].size)) == NULL) {
+		malloc_error(tracenum, i, "libc malloc failed");
+		unix_error("System message");
+	    }
+	    trace->blocks[trace->ops[i].index] = p;
+	    break;
+
+        case REGION_FREE: /* free, once per block of the region */
+	    for (k = trace->ops[i].index; k != -1; k = trace->next_id[k])
+		free(trace->blocks[k]);
+	    break;
+
+        case POOL_FREE: /* free */
+	    free(trace->blocks[trace->ops[i].index]);
+	    break;
+
 	default:
 	    app_error("invalid operation type  in eval_libc_valid");
 	}
@@ -876,7 +1886,7 @@ static int eval_libc_valid(trace_t *trace, int tracenum)
  */
 static void eval_libc_speed(void *ptr)
 {
-    int i;
+    int i, k;
     int index, size, newsize;
     char *p, *newp, *oldp, *block;
     trace_t *trace = ((speed_t *)ptr)->trace;
@@ -891,6 +1901,22 @@ static void eval_libc_speed(void *ptr)
 	    trace->blocks[index] = p;
 	    break;
 
+        case CALLOC: /* calloc */
+	    index = trace->ops[i].index;
+	    size = trace->ops[i].size;
+	    if ((p = calloc(1, size)) == NULL)
+		unix_error("calloc failed in eval_libc_speed");
+	    trace->blocks[index] = p;
+	    break;
+
+        case ALIGNED: /* aligned_alloc */
+	    index = trace->ops[i].index;
+	    size = trace->ops[i].size;
+	    if ((p = aligned_alloc(trace->ops[i].align, size)) == NULL)
+		unix_error("aligned_alloc failed in eval_libc_speed");
+	    trace->blocks[index] = p;
+	    break;
+
 	case REALLOC: /* realloc */
 	    index = trace->ops[i].index;
 	    newsize = trace->ops[i].size;
@@ -906,6 +1932,39 @@ static void eval_libc_speed(void *ptr)
 	    block = trace->blocks[index];
 	    free(block);
 	    break;
+
+        case BATCH_ALLOC: /* malloc, once per block */
+	    index = trace->ops[i].index;
+	    size = trace->ops[i].size;
+	    for (k = 0; k < trace->ops[i].count; k++) {
+		if ((p = malloc(size)) == NULL)
+		    unix_error("malloc failed in eval_libc_speed");
+		trace->blocks[index + k] = p;
+	    }
+	    break;
+
+        case BATCH_FREE: /* free, once per block */
+	    index = trace->ops[i].index;
+	    for (k = 0; k < trace->ops[i].count; k++)
+		free(trace->blocks[index + k]);
+	    break;
+
+        case REGION_ALLOC: /* malloc */
+        case POOL_ALLOC: /* malloc */
+	    index = trace->ops[i].index;
+	    if ((p = malloc(trace->ops[i].size)) == NULL)
+		unix_error("malloc failed in eval_libc_speed");
+	    trace->blocks[index] = p;
+	    break;
+
+        case REGION_FREE: /* free, once per block of the region */
+	    for (k = trace->ops[i].index; k != -1; k = trace->next_id[k])
+		free(trace->blocks[k]);
+	    break;
+
+        case POOL_FREE: /* free */
+	    free(trace->blocks[trace->ops[i].index]);
+	    break;
 	}
     }
 }
@@ -972,6 +2031,130 @@ static void printresults(int n, stats_t *stats)
 
 }
 
+/*
+ * printlatency - prints the worst-case nsecs of each kind of request
+ */
+static void printlatency(int n, stats_t *stats)
+{
+    int i, type;
+    double worst[3] = {0, 0, 0};
+
+    printf("%5s%12s%12s%12s\n", "trace", "malloc ns", "free ns", "realloc ns");
+    for (i=0; i < n; i++) {
+	if (stats[i].valid) {
+	    printf("%2d%15.0f%12.0f%12.0f\n",
+		   i,
+		   stats[i].maxlat[ALLOC],
+		   stats[i].maxlat[FREE],
+		   stats[i].maxlat[REALLOC]);
+	    for (type = 0; type < 3; type++)
+		if (stats[i].maxlat[type] > worst[type])
+		    worst[type] = stats[i].maxlat[type];
+	}
+	else {
+	    printf("%2d%15s%12s%12s\n", i, "-", "-", "-");
+	}
+    }
+    printf("%5s%12.0f%12.0f%12.0f\n", "Max  ", worst[ALLOC], worst[FREE],
+	   worst[REALLOC]);
+}
+
+/*
+ * printheap - prints the peak and end-of-trace heap sizes for mm malloc
+ */
+static void printheap(int n, stats_t *stats)
+{
+    int i;
+
+    printf("%5s%7s%10s%10s\n", "trace", "util", "peak KB", "end KB");
+    for (i=0; i < n; i++) {
+	if (stats[i].valid) {
+	    printf("%2d%9.0f%%%10.1f%10.1f\n",
+		   i,
+		   stats[i].util*100.0,
+		   stats[i].peakheap/1024.0,
+		   stats[i].endheap/1024.0);
+	}
+	else {
+	    printf("%2d%10s%10s%10s\n", i, "-", "-", "-");
+	}
+    }
+}
+
+/*
+ * printcounters - prints the mm_stats counters taken at the end of each 
+ *     trace's utilization run: live, free and largest free bytes, sbrk 
+ *     calls, coalesces by which neighbours were free (none, next, prev, 
+ *     both), free-block searches and the blocks each one looked at, and 
+ *     the free blocks left in each non-empty size class
+ */
+static void printcounters(int n, stats_t *stats)
+{
+    int i, k;
+    mm_stats_t *h;
+
+    printf("%5s%9s%9s%9s%7s%26s%9s%8s\n", "trace", "live KB", "free KB", 
+	   "big KB", "sbrks", "coalesce n/x/p/b", "fits", "probes");
+    for (i=0; i < n; i++) {
+	if (!stats[i].valid) {
+	    printf("%2d%12s%9s%9s%7s%26s%9s%8s\n", 
+		   i, "-", "-", "-", "-", "-", "-", "-");
+	    continue;
+	}
+	h = &stats[i].heap;
+	printf("%2d%12.1f%9.1f%9.1f%7lu%8lu/%5lu/%5lu/%5lu%9lu%8.2f\n",
+	       i,
+	       h->live_bytes/1024.0,
+	       h->free_bytes/1024.0,
+	       h->largest_free/1024.0,
+	       (unsigned long)h->sbrk_calls,
+	       (unsigned long)h->coalesce[0],
+	       (unsigned long)h->coalesce[1],
+	       (unsigned long)h->coalesce[2],
+	       (unsigned long)h->coalesce[3],
+	       (unsigned long)h->fit_searches,
+	       h->fit_searches ? (double)h->fit_probes / h->fit_searches : 0.0);
+	for (k = 0; k < MM_STATS_CLASSES; k++)
+	    if (h->free_blocks[k] != 0)
+		break;
+	if (k == MM_STATS_CLASSES)
+	    continue;
+	printf("%7s", "free:");
+	for (; k < MM_STATS_CLASSES; k++) {
+	    if (h->free_blocks[k] == 0)
+		continue;
+	    if (k < 6)
+		printf(" %lu@%d", (unsigned long)h->free_blocks[k], 16 << k);
+	    else
+		printf(" %lu@%dK", (unsigned long)h->free_blocks[k], 1 << (k - 6));
+	}
+	printf("\n");
+    }
+}
+
+/*
+ * printcheck - prints each trace's time with and without the incremental 
+ *     checker running every check_every ops, and the difference
+ */
+static void printcheck(int n, stats_t *stats)
+{
+    int i;
+
+    printf("%5s%10s%10s%10s\n", "trace", "secs", "checked", "overhead");
+    for (i=0; i < n; i++) {
+	if (stats[i].valid && stats[i].secs > 0) {
+	    printf("%2d%13.6f%10.6f%9.0f%%\n",
+		   i,
+		   stats[i].secs,
+		   stats[i].checksecs,
+		   (stats[i].checksecs / stats[i].secs - 1) * 100.0);
+	}
+	else {
+	    printf("%2d%13s%10s%10s\n", i, "-", "-", "-");
+	}
+    }
+}
+
 /* 
  * app_error - Report an arbitrary application error
  */
@@ -1004,14 +2187,20 @@ void malloc_error(int tracenum, int opnum, char *msg)
  */
 static void usage(void) 
 {
-    fprintf(stderr, "Usage: mdriver [-hvVal] [-f <file>] [-t <dir>]\n");
+    fprintf(stderr, "Usage: mdriver [-hvValwTPsu] [-c <n>] [-f <file>] [-t <dir>]\n");
     fprintf(stderr, "Options\n");
     fprintf(stderr, "\t-a         Don't check the team structure.\n");
+    fprintf(stderr, "\t-c <n>     Check a slice of the heap every <n> ops and report the cost.\n");
     fprintf(stderr, "\t-f <file>  Use <file> as the trace file.\n");
     fprintf(stderr, "\t-g         Generate summary info for autograder.\n");
     fprintf(stderr, "\t-h         Print this message.\n");
     fprintf(stderr, "\t-l         Run libc malloc as well.\n");
+    fprintf(stderr, "\t-s         Free with mm_free_sized.\n");
     fprintf(stderr, "\t-t <dir>   Directory to find default traces.\n");
+    fprintf(stderr, "\t-u         Replay batch, region and pool requests one block at a time.\n");
     fprintf(stderr, "\t-v         Print per-trace performance breakdowns.\n");
     fprintf(stderr, "\t-V         Print additional debug info.\n");
+    fprintf(stderr, "\t-w         Report worst-case latency of each request type.\n");
+    fprintf(stderr, "\t-T         Benchmark 1-16 threads (mdriver-mt only).\n");
+    fprintf(stderr, "\t-P         Benchmark 1-8 producer/consumer pairs (mdriver-mt only).\n");
 }
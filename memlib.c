@@ -2,7 +2,15 @@
  * memlib.c - a module that simulates the memory system.  Needed because it 
  *            allows us to interleave calls from the student's malloc package 
  *            with the system's malloc package in libc.
+ *
+ * Built with -DMEM_NATIVE, for running mm.c as the process's own malloc, 
+ * the heap is real memory instead: MAX_HEAP bytes of address space are 
+ * reserved up front, pages are only backed once a brk grows over them, 
+ * and they are handed back to the kernel when it shrinks. Nothing in 
+ * this mode may call malloc, and running out of memory is not an error 
+ * worth printing.
  */
+#define _GNU_SOURCE     /* for mremap */
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
@@ -10,28 +18,96 @@
 #include <sys/mman.h>
 #include <string.h>
 #include <errno.h>
+#include <pthread.h>
 
 #include "memlib.h"
 #include "config.h"
 
+#define MEM_MAX_ARENAS 64   /* most regions the heap can be split into */
+
+#ifdef MEM_NATIVE
+#define MEM_ERROR(msg)
+#define MEM_MAP_MAX ((size_t)-1)    /* the kernel decides how much can be mapped */
+#else
+#define MEM_ERROR(msg) fprintf(stderr, msg)
+#define MEM_MAP_MAX MAX_HEAP
+#endif
+
 /* private variables */
 static char *mem_start_brk;  /* points to first byte of heap */
-static char *mem_brk;        /* points to last byte of heap */
 static char *mem_max_addr;   /* largest legal heap address */ 
 
+/* 
+ * The heap is split into mem_narenas equal regions (arenas), each with 
+ * a brk of its own. With a single arena this is the classic model.
+ */
+static int mem_narenas;                 /* number of arenas */
+static size_t mem_arena_len;            /* bytes in each arena's region */
+static char *mem_brks[MEM_MAX_ARENAS];  /* points one past the last byte of each arena */
+static size_t mem_used;                 /* bytes below the brks, summed over arenas */
+static size_t mem_peak_used;            /* largest mem_used since the last reset */
+
+/* 
+ * Like fresh pages from a kernel, every byte a brk hands out is zero. 
+ * Each arena's bytes past its mark have never been handed out and are 
+ * still zero; bytes below it are cleared again as a brk grows over them.
+ */
+static char *mem_clean[MEM_MAX_ARENAS]; /* first byte of each arena never handed out */
+
+/* Serializes changes to the brks and mappings, as the kernel would */
+static pthread_mutex_t mem_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* 
+ * Mappings made by mem_map live outside the brk heap, each one an 
+ * independent region that can be released on its own.
+ */
+typedef struct mem_region_t {
+    char *addr;                 /* first byte of the mapping */
+    size_t len;                 /* length in bytes, a multiple of the page size */
+    struct mem_region_t *next;
+} mem_region_t;
+
+static mem_region_t *mem_regions; /* all live mappings */
+#ifdef MEM_NATIVE
+static mem_region_t *mem_spare;   /* unused region nodes, linked through next */
+#endif
+static size_t mem_mapped;         /* total bytes in live mappings */
+static size_t mem_peak;           /* largest heap plus mapped bytes since the last reset */
+
+static void mem_update_peak(void);
+static size_t mem_page_round(size_t len);
+static mem_region_t *mem_node_alloc(void);
+static void mem_node_free(mem_region_t *r);
+
 /* 
  * mem_init - initialize the memory system model
  */
 void mem_init(void)
 {
-    /* allocate the storage we will use to model the available VM */
-    if ((mem_start_brk = (char *)malloc(MAX_HEAP)) == NULL) {
+#ifdef MEM_NATIVE
+    /* reserve the address space; the kernel backs it with zero pages as it is touched */
+    mem_start_brk = mmap(NULL, MAX_HEAP, PROT_READ | PROT_WRITE, 
+			 MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (mem_start_brk == MAP_FAILED)
+	abort();
+#else
+    /* allocate the storage we will use to model the available VM, zeroed */
+    if ((mem_start_brk = (char *)calloc(1, MAX_HEAP)) == NULL) {
 	fprintf(stderr, "mem_init_vm: malloc error\n");
 	exit(1);
     }
+#endif
 
     mem_max_addr = mem_start_brk + MAX_HEAP;  /* max legal heap address */
-    mem_brk = mem_start_brk;                  /* heap is empty initially */
+    mem_narenas = 1;
+    mem_arena_len = MAX_HEAP;
+    mem_brks[0] = mem_start_brk;              /* heap is empty initially */
+    mem_clean[0] = mem_start_brk;
+    mem_used = 0;
+    mem_peak_used = 0;
+    mem_regions = NULL;
+    mem_mapped = 0;
+    mem_peak = 0;
 }
 
 /* 
@@ -39,35 +115,301 @@ void mem_init(void)
  */
 void mem_deinit(void)
 {
+    mem_reset_brk();
+#ifdef MEM_NATIVE
+    munmap(mem_start_brk, MAX_HEAP);
+#else
     free(mem_start_brk);
+#endif
 }
 
 /*
- * mem_reset_brk - reset the simulated brk pointer to make an empty heap
+ * mem_reset_brk - reset the simulated brk pointers to make an empty heap
  */
 void mem_reset_brk()
 {
-    mem_brk = mem_start_brk;
+    mem_region_t *r;
+    int i;
+
+    pthread_mutex_lock(&mem_lock);
+    for (i = 0; i < mem_narenas; i++)
+	mem_brks[i] = mem_start_brk + i * mem_arena_len;
+    mem_used = 0;
+    mem_peak_used = 0;
+
+    /* Mappings belong to the heap being reset, so they go too */
+    while ((r = mem_regions) != NULL) {
+	mem_regions = r->next;
+	munmap(r->addr, r->len);
+	mem_node_free(r);
+    }
+    mem_mapped = 0;
+    mem_peak = 0;
+    pthread_mutex_unlock(&mem_lock);
+}
+
+/*
+ * mem_set_arenas - split an empty heap into n equal, page-aligned 
+ *    arenas, each starting out empty and zeroed. Returns 0 on success, and -1 if n 
+ *    is out of range or the heap already holds memory under a 
+ *    different split.
+ */
+int mem_set_arenas(int n)
+{
+    char *lo;
+    int i;
+
+    if (n < 1 || n > MEM_MAX_ARENAS) {
+	errno = EINVAL;
+	return -1;
+    }
+    pthread_mutex_lock(&mem_lock);
+    if (n != mem_narenas) {
+	if (mem_used != 0) {
+	    pthread_mutex_unlock(&mem_lock);
+	    errno = EBUSY;
+	    return -1;
+	}
+	for (i = 0; i < mem_narenas; i++) {
+	    lo = mem_start_brk + i * mem_arena_len;
+	    memset(lo, 0, mem_clean[i] - lo);
+	}
+	mem_narenas = n;
+	mem_arena_len = (MAX_HEAP / n) & ~(mem_pagesize() - 1);
+	for (i = 0; i < n; i++)
+	    mem_brks[i] = mem_clean[i] = mem_start_brk + i * mem_arena_len;
+    }
+    pthread_mutex_unlock(&mem_lock);
+    return 0;
 }
 
 /* 
  * mem_sbrk - simple model of the sbrk function. Extends the heap 
- *    by incr bytes and returns the start address of the new area. In
- *    this model, the heap cannot be shrunk.
+ *    by incr bytes and returns the start address of the new area, 
+ *    which is always zero-filled. A negative incr shrinks the heap, but 
+ *    never below its first byte. This is the brk of arena 0.
  */
 void *mem_sbrk(int incr) 
 {
-    char *old_brk = mem_brk;
+    return mem_arena_sbrk(0, incr);
+}
 
-    if ( (incr < 0) || ((mem_brk + incr) > mem_max_addr)) {
+/*
+ * mem_arena_sbrk - mem_sbrk for the brk of the given arena, which can 
+ *    move anywhere within that arena's region
+ */
+void *mem_arena_sbrk(int arena, int incr) 
+{
+    char *lo = mem_start_brk + arena * mem_arena_len;
+    char *old_brk, *dirty;
+
+    pthread_mutex_lock(&mem_lock);
+    old_brk = mem_brks[arena];
+    if ((incr < 0) && ((old_brk + incr) < lo)) {
+	pthread_mutex_unlock(&mem_lock);
+	errno = EINVAL;
+	MEM_ERROR("ERROR: mem_sbrk failed. Heap cannot shrink below its start...\n");
+	return (void *)-1;
+    }
+    if ((old_brk + incr) > lo + mem_arena_len) {
+	pthread_mutex_unlock(&mem_lock);
 	errno = ENOMEM;
-	fprintf(stderr, "ERROR: mem_sbrk failed. Ran out of memory...\n");
+	MEM_ERROR("ERROR: mem_sbrk failed. Ran out of memory...\n");
 	return (void *)-1;
     }
-    mem_brk += incr;
+    mem_brks[arena] = old_brk + incr;
+    mem_used += incr;
+    if (mem_used > mem_peak_used)
+	mem_peak_used = mem_used;
+    mem_update_peak();
+
+    /* Clear whatever the new area held when it was handed out before */
+    dirty = (incr > 0 && old_brk < mem_clean[arena]) ? mem_clean[arena] : old_brk;
+    if (incr > 0 && dirty > old_brk + incr)
+	dirty = old_brk + incr;
+    if (old_brk + incr > mem_clean[arena])
+	mem_clean[arena] = old_brk + incr;
+#ifdef MEM_NATIVE
+    /* Give the whole pages above the new brk back; they come back zeroed */
+    if (incr < 0) {
+	char *keep = lo + mem_page_round(old_brk + incr - lo);
+	char *top = lo + mem_page_round(mem_clean[arena] - lo);
+
+	if (top > keep)
+	    madvise(keep, top - keep, MADV_DONTNEED);
+	if (keep < mem_clean[arena])
+	    mem_clean[arena] = keep;
+    }
+#endif
+    pthread_mutex_unlock(&mem_lock);
+    memset(old_brk, 0, dirty - old_brk);
     return (void *)old_brk;
 }
 
+/*
+ * mem_map - simple model of an anonymous mmap. Creates a new region of 
+ *    at least len bytes, rounded up to the page size, outside the brk 
+ *    heap and returns its start address. Mapped bytes count against 
+ *    the same MAX_HEAP budget as the heap.
+ */
+void *mem_map(size_t len)
+{
+    mem_region_t *r;
+    char *addr;
+
+    len = mem_page_round(len);
+    pthread_mutex_lock(&mem_lock);
+    if (len == 0 || len > MEM_MAP_MAX - mem_mapped) {
+	pthread_mutex_unlock(&mem_lock);
+	errno = ENOMEM;
+	MEM_ERROR("ERROR: mem_map failed. Ran out of memory...\n");
+	return (void *)-1;
+    }
+    addr = mmap(NULL, len, PROT_READ | PROT_WRITE, 
+		MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (addr == MAP_FAILED) {
+	pthread_mutex_unlock(&mem_lock);
+	return (void *)-1;
+    }
+    if ((r = mem_node_alloc()) == NULL) {
+	munmap(addr, len);
+	pthread_mutex_unlock(&mem_lock);
+	return (void *)-1;
+    }
+    r->addr = addr;
+    r->len = len;
+    r->next = mem_regions;
+    mem_regions = r;
+    mem_mapped += len;
+    mem_update_peak();
+    pthread_mutex_unlock(&mem_lock);
+    return (void *)addr;
+}
+
+/*
+ * mem_remap - resize the mapping that starts at addr to at least len 
+ *    bytes, moving it if it cannot grow where it is. Returns its 
+ *    (possibly new) start address, or (void *)-1 on failure, in which 
+ *    case the old mapping is left alone.
+ */
+void *mem_remap(void *addr, size_t len)
+{
+    mem_region_t *r;
+    char *newaddr;
+
+    len = mem_page_round(len);
+    pthread_mutex_lock(&mem_lock);
+    for (r = mem_regions; r != NULL; r = r->next)
+	if (r->addr == (char *)addr)
+	    break;
+    if (r == NULL || len == 0) {
+	pthread_mutex_unlock(&mem_lock);
+	errno = EINVAL;
+	return (void *)-1;
+    }
+    if (len > MEM_MAP_MAX - (mem_mapped - r->len)) {
+	pthread_mutex_unlock(&mem_lock);
+	errno = ENOMEM;
+	MEM_ERROR("ERROR: mem_remap failed. Ran out of memory...\n");
+	return (void *)-1;
+    }
+#ifdef MREMAP_MAYMOVE
+    newaddr = mremap(r->addr, r->len, len, MREMAP_MAYMOVE);
+#else
+    newaddr = mmap(NULL, len, PROT_READ | PROT_WRITE, 
+		   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (newaddr != MAP_FAILED) {
+	memcpy(newaddr, r->addr, (len < r->len) ? len : r->len);
+	munmap(r->addr, r->len);
+    }
+#endif
+    if (newaddr == MAP_FAILED) {
+	pthread_mutex_unlock(&mem_lock);
+	return (void *)-1;
+    }
+    mem_mapped = mem_mapped - r->len + len;
+    r->addr = newaddr;
+    r->len = len;
+    mem_update_peak();
+    pthread_mutex_unlock(&mem_lock);
+    return (void *)newaddr;
+}
+
+/*
+ * mem_unmap - release the whole mapping that starts at addr. Returns 0 
+ *    on success and -1 if addr does not start a mapping.
+ */
+int mem_unmap(void *addr)
+{
+    mem_region_t **rp, *r;
+
+    pthread_mutex_lock(&mem_lock);
+    for (rp = &mem_regions; (r = *rp) != NULL; rp = &r->next) {
+	if (r->addr == (char *)addr) {
+	    *rp = r->next;
+	    munmap(r->addr, r->len);
+	    mem_mapped -= r->len;
+	    mem_node_free(r);
+	    pthread_mutex_unlock(&mem_lock);
+	    return 0;
+	}
+    }
+    pthread_mutex_unlock(&mem_lock);
+    errno = EINVAL;
+    return -1;
+}
+
+/*
+ * mem_fork_prepare, mem_fork_parent, mem_fork_child - pthread_atfork 
+ *    handlers: hold mem_lock across a fork so the child's copy of the 
+ *    brks and mappings is never caught half-changed
+ */
+void mem_fork_prepare(void)
+{
+    pthread_mutex_lock(&mem_lock);
+}
+
+void mem_fork_parent(void)
+{
+    pthread_mutex_unlock(&mem_lock);
+}
+
+void mem_fork_child(void)
+{
+    pthread_mutex_init(&mem_lock, NULL);
+}
+
+/*
+ * mem_is_mapped - return 1 if the bytes lo..hi all lie inside one live 
+ *    mapping, 0 otherwise
+ */
+int mem_is_mapped(void *lo, void *hi)
+{
+    mem_region_t *r;
+    int found = 0;
+
+    pthread_mutex_lock(&mem_lock);
+    for (r = mem_regions; r != NULL; r = r->next)
+	if ((char *)lo >= r->addr && (char *)hi < r->addr + r->len)
+	    found = 1;
+    pthread_mutex_unlock(&mem_lock);
+    return found;
+}
+
+/*
+ * mem_is_heap - return 1 if the bytes lo..hi all lie inside the heap of 
+ *    one arena, 0 otherwise
+ */
+int mem_is_heap(void *lo, void *hi)
+{
+    int i;
+
+    for (i = 0; i < mem_narenas; i++)
+	if ((char *)lo >= (char *)mem_arena_lo(i) && (char *)hi < mem_brks[i])
+	    return 1;
+    return 0;
+}
+
 /*
  * mem_heap_lo - return address of the first heap byte
  */
@@ -77,19 +419,78 @@ void *mem_heap_lo()
 }
 
 /* 
- * mem_heap_hi - return address of last heap byte
+ * mem_heap_hi - return address of last heap byte (of arena 0)
  */
 void *mem_heap_hi()
 {
-    return (void *)(mem_brk - 1);
+    return (void *)(mem_brks[0] - 1);
+}
+
+/*
+ * mem_arena_lo - return address of the first byte of an arena's heap
+ */
+void *mem_arena_lo(int arena)
+{
+    return (void *)(mem_start_brk + arena * mem_arena_len);
+}
+
+/*
+ * mem_arena_hi - return address of the last byte of an arena's heap
+ */
+void *mem_arena_hi(int arena)
+{
+    return (void *)(mem_brks[arena] - 1);
 }
 
 /*
- * mem_heapsize() - returns the heap size in bytes
+ * mem_heapsize() - returns the heap size in bytes, summed over arenas
  */
 size_t mem_heapsize() 
 {
-    return (size_t)(mem_brk - mem_start_brk);
+    return mem_used;
+}
+
+/*
+ * mem_arena_heapsize() - returns the size in bytes of an arena's heap
+ */
+size_t mem_arena_heapsize(int arena) 
+{
+    return (size_t)(mem_brks[arena] - (char *)mem_arena_lo(arena));
+}
+
+/*
+ * mem_arena_room() - returns how many bytes an arena's brk can still 
+ *    grow by before it reaches the end of its region
+ */
+size_t mem_arena_room(int arena) 
+{
+    return (size_t)((char *)mem_arena_lo(arena) + mem_arena_len - mem_brks[arena]);
+}
+
+/*
+ * mem_peak_heapsize() - returns the largest heap size in bytes since 
+ *    the heap was last reset
+ */
+size_t mem_peak_heapsize() 
+{
+    return mem_peak_used;
+}
+
+/*
+ * mem_mapsize() - returns the total size in bytes of all live mappings
+ */
+size_t mem_mapsize() 
+{
+    return mem_mapped;
+}
+
+/*
+ * mem_peak_footprint() - returns the largest heap size plus mapped 
+ *    bytes since the heap was last reset
+ */
+size_t mem_peak_footprint() 
+{
+    return mem_peak;
 }
 
 /*
@@ -99,3 +500,64 @@ size_t mem_pagesize()
 {
     return (size_t)getpagesize();
 }
+
+/*
+ * mem_update_peak - fold the current heap plus mapped bytes into the peak
+ */
+static void mem_update_peak(void)
+{
+    size_t footprint = mem_heapsize() + mem_mapped;
+
+    if (footprint > mem_peak)
+	mem_peak = footprint;
+}
+
+/*
+ * mem_page_round - round len up to a multiple of the page size
+ */
+static size_t mem_page_round(size_t len)
+{
+    size_t pagesize = mem_pagesize();
+
+    return (len + pagesize - 1) & ~(pagesize - 1);
+}
+
+/*
+ * mem_node_alloc - take a node for a new mapping, with mem_lock held. 
+ *    Under MEM_NATIVE malloc is mm.c itself, so nodes come from pages 
+ *    of their own instead.
+ */
+static mem_region_t *mem_node_alloc(void)
+{
+#ifdef MEM_NATIVE
+    mem_region_t *r;
+    size_t i;
+
+    if (mem_spare == NULL) {
+	r = mmap(NULL, mem_pagesize(), PROT_READ | PROT_WRITE, 
+		 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (r == MAP_FAILED)
+	    return NULL;
+	for (i = 0; i < mem_pagesize() / sizeof(mem_region_t); i++)
+	    mem_node_free(&r[i]);
+    }
+    r = mem_spare;
+    mem_spare = r->next;
+    return r;
+#else
+    return (mem_region_t *)malloc(sizeof(mem_region_t));
+#endif
+}
+
+/*
+ * mem_node_free - return a mapping's node, with mem_lock held
+ */
+static void mem_node_free(mem_region_t *r)
+{
+#ifdef MEM_NATIVE
+    r->next = mem_spare;
+    mem_spare = r;
+#else
+    free(r);
+#endif
+}
@@ -7,5 +7,22 @@ void mem_reset_brk(void);
 void *mem_heap_lo(void);
 void *mem_heap_hi(void);
 size_t mem_heapsize(void);
+int mem_set_arenas(int n);
+void *mem_arena_sbrk(int arena, int incr);
+void *mem_arena_lo(int arena);
+void *mem_arena_hi(int arena);
+size_t mem_arena_heapsize(int arena);
+size_t mem_arena_room(int arena);
+int mem_is_heap(void *lo, void *hi);
+size_t mem_peak_heapsize(void);
+void *mem_map(size_t len);
+void *mem_remap(void *addr, size_t len);
+int mem_unmap(void *addr);
+int mem_is_mapped(void *lo, void *hi);
+size_t mem_mapsize(void);
+size_t mem_peak_footprint(void);
 size_t mem_pagesize(void);
+void mem_fork_prepare(void);
+void mem_fork_parent(void);
+void mem_fork_child(void);
 
@@ -33,9 +33,13 @@
 #include <unistd.h>
 #include <string.h>
 #include <signal.h>
+#if MM_THREADS
+#include <pthread.h>
+#endif
 
 #include "mm.h"
 #include "memlib.h"
+#include "config.h"
 
 /*********************************************************
  * NOTE TO STUDENTS: Before you do anything else, please
@@ -63,17 +67,42 @@ team_t team = {
 
 #define SIZE_T_SIZE (ALIGN(sizeof(size_t)))
 
+/*
+ * Heap payloads are aligned to BLOCK_ALIGN bytes, which is ALIGNMENT
+ * unless the build asks for more: block sizes are multiples of it and the
+ * first payload of an arena starts on it. The LD_PRELOAD build uses 16,
+ * the alignment malloc owes max_align_t on x86-64.
+ */
+#ifndef BLOCK_ALIGN
+#define BLOCK_ALIGN ALIGNMENT
+#endif
+#define BLOCK_ROUND(size) (((size) + (BLOCK_ALIGN-1)) & ~(size_t)(BLOCK_ALIGN-1))
+
 /* Basic constants and macros */
 #define WSIZE 4                 /* Word and header/footer size in bytes */
 #define DSIZE 8                 /* Double word size in bytes */
-#define MIN_BLOCK_SIZE 16       /* Blocks must be at least 24 bytes as that is the min size for free blocks */
+#define MIN_BLOCK_SIZE 16       /* Blocks must be at least 16 bytes as that is the min size for free blocks */
 #define CHUNKSIZE (1 << 12)     /* Extend heap by this amount (bytes) */
 
 #define MAX(x,y) ((x) > (y) ? (x) : (y))
+#define MIN(x,y) ((x) < (y) ? (x) : (y))
 
-/* Pack a size and allocated bit into a word */
+/*
+ * Pack a size and allocated bits into a word. Bit 0 marks the block
+ * itself allocated; PREV_ALLOC (bit 1) marks the block before it
+ * allocated, which is what lets allocated blocks go without a footer.
+ */
+#define PREV_ALLOC 0x2
 #define PACK(size, alloc) ((size) | (alloc))
 
+/*
+ * GROWING (bit 2) marks an allocated block that mm_realloc has grown
+ * more than once. Such a block may hold slack past what was asked for,
+ * and is recorded in the grow table so the slack can be reclaimed.
+ */
+#define GROWING 0x4
+#define GROW_SLOTS 8
+
 /* Read and write a word at address p */
 #define GET(p)          (*(unsigned int *)(p))
 #define PUT(p, val)     (*(unsigned int *)(p) = (val))
@@ -81,12 +110,18 @@ team_t team = {
 /* Read the size and allocated fields from address p */
 #define GET_SIZE(p)     (GET(p) & ~0x7)
 #define GET_ALLOC(p)    (GET(p) & 0x1)
+#define GET_PREV_ALLOC(p) (GET(p) & PREV_ALLOC)
+#define GET_GROWING(p)  (GET(p) & GROWING)
 
-/* Given block pointer bp, compute address of its header and footer */
+/* Set or clear the prev-allocated bit of the header at address p */
+#define SET_PREV_ALLOC(p) PUT(p, GET(p) | PREV_ALLOC)
+#define CLR_PREV_ALLOC(p) PUT(p, GET(p) & ~PREV_ALLOC)
+
+/* Given block pointer bp, compute address of its header and footer (free blocks only) */
 #define HDRP(bp)        ((char *)(bp) - WSIZE)
 #define FTRP(bp)        ((char *)(bp) + GET_SIZE(HDRP(bp)) - DSIZE)
 
-/* Given block ptr bp, compute address of next and previous blocks */
+/* Given block ptr bp, compute address of next and previous blocks (PREV_BLKP only if it is free) */
 #define NEXT_BLKP(bp)   ((char *)(bp) + GET_SIZE(((char *)(bp) - WSIZE)))
 #define PREV_BLKP(bp)   ((char *)(bp) - GET_SIZE(((char *)(bp) - DSIZE)))
 
@@ -94,385 +129,3230 @@ team_t team = {
 #define PREV_FREE(bp)   ((char *)(bp))
 #define NEXT_FREE(bp)   ((char *)(bp) + WSIZE)
 
-#define GET_PREV_FREE(bp) (*(char **)(PREV_FREE(bp)))
-#define GET_NEXT_FREE(bp) (*(char **)(NEXT_FREE(bp)))
+/*
+ * Read and write a free-list link stored at address p. Links are 32-bit
+ * offsets from the start of the heap, so a 16-byte free block still has
+ * room for two of them on a 64-bit build. Offset 0 is the alignment
+ * padding word, which no block starts at, so it stands for NULL.
+ */
+#define GET_PTR(p)      (GET(p) ? heap_base + GET(p) : NULL)
+#define PUT_PTR(p, val) PUT(p, (val) ? (unsigned int)((char *)(val) - heap_base) : 0)
+
+#define GET_PREV_FREE(bp) GET_PTR(PREV_FREE(bp))
+#define GET_NEXT_FREE(bp) GET_PTR(NEXT_FREE(bp))
+
+#define PACK_PREV(bp, val)  PUT_PTR(PREV_FREE(bp), val)
+#define PACK_NEXT(bp, val)  PUT_PTR(NEXT_FREE(bp), val)
+
+/*
+ * Free-block index used by find_fit, insertBlock and removeBlock.
+ * Override FIT_POLICY at compile time (e.g. -DFIT_POLICY=FIT_TLSF).
+ *   FIT_SEGLIST - power-of-two segregated lists, first fit within a class,
+ *                 with large blocks kept in a best-fit red-black tree
+ *   FIT_TLSF    - two-level segregated fit with bitmaps, O(1) malloc/free
+ *   FIT_ADDRORDER - address-ordered first fit over a skip list, O(log n)
+ */
+#define FIT_SEGLIST 0
+#define FIT_TLSF    1
+#define FIT_ADDRORDER 2
+
+#ifndef FIT_POLICY
+#define FIT_POLICY FIT_SEGLIST
+#endif
+
+/*
+ * Segregated free lists. Class k holds free blocks whose size lies in
+ * [2^(k+4), 2^(k+5)). Blocks of TREE_MIN_SIZE bytes or more go in the
+ * tree instead of a list.
+ */
+#define MIN_CLASS_SHIFT 4
+#define TREE_MIN_SHIFT 11
+#define TREE_MIN_SIZE (1 << TREE_MIN_SHIFT)
+#define NUM_CLASSES (TREE_MIN_SHIFT - MIN_CLASS_SHIFT)
+
+/*
+ * Red-black tree of large free blocks, ordered by size and then by
+ * address. The node lives in the free block's payload: left, right and
+ * parent links followed by a colour word.
+ */
+#define TREE_LEFT(bp)   ((char *)(bp))
+#define TREE_RIGHT(bp)  ((char *)(bp) + WSIZE)
+#define TREE_PARENT(bp) ((char *)(bp) + (2*WSIZE))
+#define TREE_COLOR(bp)  ((char *)(bp) + (3*WSIZE))
+
+#define GET_LEFT(bp)    GET_PTR(TREE_LEFT(bp))
+#define GET_RIGHT(bp)   GET_PTR(TREE_RIGHT(bp))
+#define GET_PARENT(bp)  GET_PTR(TREE_PARENT(bp))
+
+#define PACK_LEFT(bp, val)   PUT_PTR(TREE_LEFT(bp), val)
+#define PACK_RIGHT(bp, val)  PUT_PTR(TREE_RIGHT(bp), val)
+#define PACK_PARENT(bp, val) PUT_PTR(TREE_PARENT(bp), val)
+
+#define RED   0
+#define BLACK 1
+
+/* Colour of a node; empty subtrees count as black */
+#define IS_RED(bp)      ((bp) != NULL && GET(TREE_COLOR(bp)) == RED)
+
+/*
+ * TLSF index. The first level splits sizes by power of two and the
+ * second level splits each power-of-two range into SL_COUNT equal
+ * lists. Sizes below 2^FL_SHIFT all share first level 0, in 8-byte steps.
+ */
+#define SL_LOG2  4
+#define SL_COUNT (1 << SL_LOG2)
+#define FL_SHIFT (SL_LOG2 + 3)
+#define FL_COUNT (32 - FL_SHIFT + 1)
+
+/*
+ * Address-ordered skip list. Level 0 links every free block in address
+ * order. Each link at level i >= 1 also records the largest block in the
+ * span it jumps over (up to and including its target), so first fit can
+ * skip whole spans that are too small. A node's height is random (p = 1/4)
+ * but capped by the free block's size: level 0 takes one word and every
+ * level above it takes a link and a span word.
+ */
+#define SKIP_LEVELS 10
+#define SKIP_NEXTP(bp, i) ((char *)(bp) + ((i) ? (2*(i) - 1) : 0) * WSIZE)
+#define SKIP_SPANP(bp, i) ((char *)(bp) + (2*(i)) * WSIZE)
+
+/* Most bytes of links any policy keeps at the start of a free block (a full-height skip node) */
+#define FREE_LINK_BYTES (2 * SKIP_LEVELS * WSIZE)
+
+
+
+/*
+ * Slab engine for small requests. Requests of up to SLAB_MAX bytes are
+ * served from SLAB_PAGE-sized, page-aligned blocks carved into equal
+ * slots, one size class per 8 bytes. Slots have no header: slab_map
+ * records the class of every heap page (0 for ordinary heap), so mm_free
+ * and mm_realloc find an object's size from its address alone.
+ * Override USE_SLAB at compile time (-DUSE_SLAB=0) to turn it off.
+ */
+#ifndef USE_SLAB
+#define USE_SLAB 1
+#endif
+
+#define SLAB_MAX 128
+#define SLAB_CLASSES (SLAB_MAX / DSIZE)
+#define SLAB_SHIFT 12
+#define SLAB_PAGE (1 << SLAB_SHIFT)
+#define SLAB_MAP_SIZE (MAX_HEAP / SLAB_PAGE + 1)
+
+/* Given a pointer into a slab page, compute the page and its slab_map index */
+#define SLAB_BASE(p)    ((char *)((size_t)(p) & ~(size_t)(SLAB_PAGE-1)))
+#define SLAB_INDEX(p)   (((size_t)(p) >> SLAB_SHIFT) - ((size_t)mem_heap_lo() >> SLAB_SHIFT))
+
+/*
+ * Page metadata at the start of every slab page: links for the class's
+ * list of pages with free slots, the head of the page's free-slot list,
+ * the number of slots in use and the offset of the first never-used slot.
+ */
+#define SLAB_NEXT(pg)   ((char *)(pg))
+#define SLAB_PREV(pg)   ((char *)(pg) + WSIZE)
+#define SLAB_FREE(pg)   ((char *)(pg) + (2*WSIZE))
+#define SLAB_USED(pg)   ((char *)(pg) + (3*WSIZE))
+#define SLAB_BUMP(pg)   ((char *)(pg) + (4*WSIZE))
+#define SLAB_HDR        BLOCK_ROUND(6*WSIZE)
+
+/*
+ * The class of a small request: its size in DSIZE units, rounded up to
+ * a whole number of BLOCK_ALIGN units once it is too big for one DSIZE
+ * slot, so larger objects keep the heap's alignment.
+ */
+#define SLAB_CLASS(size) \
+    ((size) <= DSIZE ? 1 : (((size) + (BLOCK_ALIGN-1)) / BLOCK_ALIGN) * (BLOCK_ALIGN / DSIZE))
+
+/* A slab page is full once it has no free slot and no room left to bump */
+#define SLAB_FULL(pg, objsize) \
+    (GET_PTR(SLAB_FREE(pg)) == NULL && GET(SLAB_BUMP(pg)) + (objsize) > SLAB_PAGE)
+
+
+
+/*
+ * Quick lists (deferred coalescing). A freed block of at most QUICK_MAX
+ * bytes keeps its allocated header and goes on a LIFO list of blocks of
+ * exactly its size, so a following malloc of that size reuses it with no
+ * coalesce or split. quick_consolidate() frees and coalesces them for
+ * real once a request misses and the heap is about to grow. Off by
+ * default under FIT_TLSF, whose constant-time bound consolidation breaks.
+ */
+#ifndef USE_QUICK
+#define USE_QUICK (FIT_POLICY != FIT_TLSF)
+#endif
+
+#define QUICK_MAX 512
+#define QUICK_LISTS (QUICK_MAX / DSIZE + 1)
+
+/*
+ * Heap trimming. When freeing leaves a free block of at least
+ * TRIM_THRESHOLD bytes at the top of the heap, everything in it beyond
+ * TRIM_KEEP bytes is handed back to memlib with a negative mem_sbrk.
+ */
+#ifndef TRIM_THRESHOLD
+#define TRIM_THRESHOLD (32 * CHUNKSIZE)
+#endif
+#define TRIM_KEEP CHUNKSIZE
+
+/*
+ * Huge requests of at least MMAP_THRESHOLD bytes get a mapping of their
+ * own from mem_map instead of a block in the brk heap, and freeing one
+ * unmaps it right away. The payload starts MAPPED_PAD bytes into the
+ * mapping, or further in for a memalign of up to a page, and its header
+ * records that offset. A mapping can outgrow a header's 32-bit size, so
+ * its length goes in the size_t word MAPPED_PAD bytes before the payload.
+ * Anything outside the arenas' regions is a mapped block.
+ */
+#ifndef MMAP_THRESHOLD
+#define MMAP_THRESHOLD (64 * CHUNKSIZE)
+#endif
+#define MAPPED_PAD      BLOCK_ROUND(sizeof(size_t) + WSIZE)
+#define MAPPED_OFF(bp)  GET_SIZE(HDRP(bp))
+#define MAPPED_BASE(bp) ((char *)(bp) - MAPPED_OFF(bp))
+#define MAPPED_LEN(bp)  (*(size_t *)((char *)(bp) - MAPPED_PAD))
+#define IS_MAPPED(bp)   ((char *)(bp) < heap_base || (char *)(bp) >= heap_base + MAX_HEAP)
+
+/* No request bigger than the brk heap can be placed in it, and refusing
+   them up front keeps adjust_size and friends from overflowing */
+#define TOO_BIG(size)   ((size) > MAX_HEAP)
+
+/*
+ * Regions bump-allocate inside REGION_CHUNK-byte chunks from mm_malloc,
+ * sized so a chunk is one CHUNKSIZE heap block. The first chunk holds the
+ * region itself; every later one starts with a link to the one before,
+ * REGION_HDR bytes so the objects after it stay aligned. Requests over
+ * REGION_BIG get a chunk of their own rather than waste the rest of one.
+ */
+#define REGION_CHUNK    (CHUNKSIZE - WSIZE)
+#define REGION_HDR      ALIGN(sizeof(char *))
+#define REGION_BIG      (REGION_CHUNK / 4)
+
+/*
+ * Pools hand out objects of one fixed size from pages taken from the heap
+ * with mm_memalign, so the page holding an object is found by masking its
+ * address. A page is POOL_PAGE bytes, or the smallest larger power of two
+ * that holds POOL_MIN_OBJS objects, less the heap block's header word. It
+ * starts with a pool_page_t; objects carry no header and are linked through
+ * their first word while free.
+ */
+#define POOL_PAGE       CHUNKSIZE
+#define POOL_MIN_OBJS   8
+#define POOL_HDR        ALIGN(sizeof(pool_page_t))
+#define POOL_PAGE_OF(obj, pagesize) ((pool_page_t *)((size_t)(obj) & ~((size_t)(pagesize) - 1)))
+#define POOL_PAGE_FULL(pool, pg) \
+    ((pg)->free == NULL && (pg)->bump + (pool)->objsize > (char *)(pg) + (pool)->pagesize - WSIZE)
+
+/*
+ * Thread-safe mode, built with -DMM_THREADS. Each arena has a lock, and
+ * each thread keeps up to TCACHE_COUNT slab objects per class in a cache
+ * of its own, so hot malloc/free pairs of small blocks never take a lock.
+ * A cache refills from and spills back to the slabs TCACHE_BATCH objects
+ * at a time.
+ */
+#ifndef MM_THREADS
+#define MM_THREADS 0
+#endif
+#define TCACHE (MM_THREADS && USE_SLAB && !MM_BINLOCKS)
+#define TCACHE_COUNT 32
+#define TCACHE_BATCH 16
+
+/*
+ * Per-bin locking, built with -DMM_THREADS -DMM_BINLOCKS. Instead of
+ * keeping per-thread caches, every thread shares one heap, and each slab
+ * size class (bin) has a lock of its own, so small requests of different
+ * sizes never collide. Everything else -- the free-block index, quick
+ * lists, coalescing, and slab pages taken from or handed back to the
+ * heap -- stays under the heap lock (arena 0's).
+ *
+ * Lock order: a bin lock comes before the heap lock. A thread holds at
+ * most one bin lock, and never takes one while holding the heap lock,
+ * which is why slab objects are realloc'd outside it. A bin lock spins
+ * on trylock BIN_SPINS times before sleeping, and each bin counts its
+ * acquisitions, failed spins and sleeps for mm_bin_stats.
+ */
+#ifndef MM_BINLOCKS
+#define MM_BINLOCKS 0
+#endif
+#if MM_BINLOCKS && !MM_THREADS
+#error "MM_BINLOCKS needs MM_THREADS"
+#endif
+#define BIN_LOCKING (MM_BINLOCKS && USE_SLAB)
+#define BIN_SPINS 64
+
+/*
+ * Arenas. Each arena is an independent heap in its own region of the
+ * simulated heap (memlib gives every arena a brk of its own), with its
+ * own free-block index, quick lists, slab pages, grow table and lock.
+ * A block belongs to the arena whose region holds it, so frees are
+ * routed by address. A thread is assigned to the arena with the fewest
+ * threads the first time it calls in, and stays there until it exits.
+ *
+ * A thread freeing a block that belongs to another arena does not take
+ * that arena's lock. It pushes the block onto the arena's remote-free
+ * queue instead, a lock-free stack linked through the blocks' payloads
+ * that any thread may push onto. The arena's owner takes the whole
+ * stack with one atomic exchange the next time it mallocs, and frees
+ * the blocks under the lock it already holds. With a single consumer
+ * that only ever empties the stack, pushes need no ABA protection.
+ */
+#ifndef MM_ARENAS
+#define MM_ARENAS ((MM_THREADS && !MM_BINLOCKS) ? 4 : 1)
+#endif
+#if MM_BINLOCKS && MM_ARENAS != 1
+#error "MM_BINLOCKS shares a single heap; build it with MM_ARENAS=1"
+#endif
+#define ARENA_OF(bp)    (&arenas[((char *)(bp) - heap_base) / arena_span])
+
+#if MM_THREADS
+#define ARENA_LOCAL __thread
+#else
+#define ARENA_LOCAL
+#endif
+
+/*
+ * Heap counters for mm_stats. Each costs an add or two on a path that
+ * already touches the block, so they are always kept: the free-index
+ * totals in insertBlock and removeBlock, the rest where the event
+ * happens. The largest free block is not a counter; mm_stats reads it
+ * off the free index.
+ */
+#define STATS_CLASS(size) MIN(27 - __builtin_clz((unsigned int)(size)), MM_STATS_CLASSES - 1)
+
+typedef struct {
+    size_t free_bytes;                      /* bytes in the free index */
+    size_t free_count[MM_STATS_CLASSES];    /* blocks in the free index, per STATS_CLASS */
+    size_t quick_bytes;                     /* bytes waiting on quick lists */
+    size_t sbrks;
+    size_t coalesces[4];                    /* indexed by (prev free << 1) | next free */
+    size_t fit_searches;
+    size_t fit_probes;
+} heap_counters_t;
+
+/*
+ * Incremental heap checker. mm_check_slice looks at no more than a
+ * budget of blocks and free-index nodes per call, so it can run under
+ * load. Each arena keeps two cursors between calls: one walking the heap
+ * block by block, one walking the free index list by list. The walks
+ * cross-check each other -- every free block the heap walk meets must be
+ * linked into the index where its neighbours say it is, and every node
+ * the index walk meets must be a well-formed free block on the right
+ * list -- and a pass that sees no insertBlock or removeBlock from start
+ * to end checks its totals against the free-index counters.
+ *
+ * The heap cursor must always sit on a block start, so coalesce, heap
+ * growth in realloc and heap_trim pull it back with CHK_ABSORB when a
+ * block grows over it. The index cursor moves on when removeBlock
+ * unlinks its node.
+ */
+#define CHK_ABSORB(bp, size) \
+    do { if (ar->chk.block > (char *)(bp) && ar->chk.block < (char *)(bp) + (size)) ar->chk.block = (char *)(bp); } while (0)
+
+typedef struct {
+    char *block;            /* next block of the heap walk, NULL before a pass */
+    size_t block_count;     /* free blocks and bytes the heap walk has passed */
+    size_t block_bytes;
+    size_t block_start;     /* changes when the heap walk's pass began */
+    int list;               /* free list the index walk is on, -1 before a pass */
+    char *node;             /* next node of the index walk, NULL for its list's first */
+    size_t node_count;      /* nodes and bytes the index walk has passed */
+    size_t node_bytes;
+    size_t node_start;      /* changes when the index walk's pass began */
+    size_t changes;         /* insertBlock and removeBlock calls */
+} checker_t;
+
+/* One arena: an independent heap with its own region, index and lock */
+typedef struct {
+    char *heap_listp;           /* prologue block of the arena's heap, 0 until first use */
+    int id;                     /* memlib arena number */
+    
+#if USE_QUICK
+    /* Quick-list heads, indexed by block size / DSIZE */
+    char *quick_lists[QUICK_LISTS];
+    int quick_count;
+#endif
+    
+#if USE_SLAB
+    /* Slab pages with free slots, per class */
+    char *slab_partial[SLAB_CLASSES + 1];
+#endif
+    
+    /* Grow table: blocks with GROWING set and the block size they actually need */
+    char *grow_blocks[GROW_SLOTS];
+    size_t grow_need[GROW_SLOTS];
+    int grow_victim;
+    
+#if FIT_POLICY == FIT_TLSF
+    /* TLSF lists plus bitmaps of which lists are non-empty */
+    char *tlsf_lists[FL_COUNT][SL_COUNT];
+    unsigned int fl_bitmap;
+    unsigned int sl_bitmap[FL_COUNT];
+#elif FIT_POLICY == FIT_ADDRORDER
+    /* Skip-list head links and spans, and the tallest level in use */
+    char *skip_head_next[SKIP_LEVELS];
+    size_t skip_head_span[SKIP_LEVELS];
+    int skip_top;
+    unsigned int skip_seed;
+#else
+    /* Free-list heads, one per size class, and the root of the large-block tree */
+    char *seg_lists[NUM_CLASSES];
+    char *tree_root;
+#endif
+    
+    /* Counters reported by mm_arena_stats and mm_stats */
+    size_t mallocs;
+    size_t frees;
+    size_t contended;
+    heap_counters_t ctr;
+    
+    checker_t chk;              /* incremental checker cursors, see mm_check_slice */
+#if MM_THREADS
+    pthread_mutex_t lock;
+    int threads;                /* threads assigned to this arena */
+    char *remote_head;          /* remote-free queue, pushed with CAS */
+    size_t remote_frees;        /* blocks drained from the queue */
+#endif
+} arena_t;
+
+/* A region: the chunks it owns past its first, and the free part of the newest */
+struct mm_region {
+    char *chunks;               /* newest extra chunk, linked through its first word */
+    char *bump;                 /* next free byte */
+    char *end;                  /* end of the chunk being bumped through */
+};
+
+/* The header of a pool page */
+typedef struct pool_page {
+    struct pool_page *next;     /* neighbours on the pool's partial or full list */
+    struct pool_page *prev;
+    char *free;                 /* freed objects, linked through their first word */
+    char *bump;                 /* first never-used byte */
+    size_t used;                /* objects handed out and not yet put back */
+} pool_page_t;
+
+/* A pool: its object and page sizes, and its pages by whether they have room */
+struct mm_pool {
+    size_t objsize;
+    size_t pagesize;
+    pool_page_t *partial;
+    pool_page_t *full;
+};
+
+/* Static global arenas, and the arena the heap_* functions are working on */
+static arena_t arenas[MM_ARENAS];
+static ARENA_LOCAL arena_t *ar;
+#if MM_ARENAS > 1
+static ARENA_LOCAL int ar_last;    /* set while arena_malloc tries its last arena */
+#endif
+
+static char *heap_base;     /* mem_heap_lo(), the origin of every link offset */
+static size_t arena_span;   /* bytes between the starts of consecutive arenas */
+
+#if USE_SLAB
+/* Static global slab page map, shared by every arena */
+static unsigned char slab_map[SLAB_MAP_SIZE];
+#endif
+
+#if MM_THREADS
+/* Static global thread state: the thread's arena, and the key that notices it exit */
+static ARENA_LOCAL arena_t *my_arena;
+static pthread_mutex_t assign_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t thread_key;
+static pthread_once_t thread_once = PTHREAD_ONCE_INIT;
+#endif
 
-#define PACK_PREV(bp, val)  ((GET_PREV_FREE(bp)) = (val))
-#define PACK_NEXT(bp, val)  ((GET_NEXT_FREE(bp)) = (val))
+#if BIN_LOCKING
+/* One slab class's lock and its contention counters */
+typedef struct {
+    pthread_mutex_t lock;
+    size_t acquires;
+    size_t spins;       /* trylocks that found the lock taken */
+    size_t sleeps;      /* acquisitions that gave up spinning and blocked */
+} bin_t;
 
+/* Static global bins, indexed by slab class */
+static bin_t bins[SLAB_CLASSES + 1];
 
+/* Slab code takes the heap lock itself, nested inside the bin lock */
+#define SLAB_HEAP_LOCK()    arena_lock(&arenas[0])
+#define SLAB_HEAP_UNLOCK()  arena_unlock(&arenas[0])
+#else
+#define SLAB_HEAP_LOCK()
+#define SLAB_HEAP_UNLOCK()
+#endif
 
-/* Static global pointer to prologue block of heap */
-static char *heap_listp = 0;
+#if TCACHE
+/* Per-thread cache of slab objects, linked through their first word */
+typedef struct {
+    char *head[SLAB_CLASSES + 1];
+    int count[SLAB_CLASSES + 1];
+    unsigned int epoch;     /* heap_epoch the cached objects belong to */
+} tcache_t;
 
-/* Static global pointer to head of free-list */
-static char *free_listp = 0;
+static __thread tcache_t tcache;
+static unsigned int heap_epoch;     /* bumped by mm_init, which invalidates every cache */
+#endif
 
 
 /* Forward-declarations of helper functions */
+static int heap_init(void);
+static arena_t *arena_pick(void);
+static void arena_lock(arena_t *a);
+static void arena_unlock(arena_t *a);
+#if MM_THREADS
+static void thread_key_init(void);
+static void thread_exit(void *arg);
+static void remote_push(arena_t *a, void *bp);
+static void remote_drain(arena_t *a);
+#endif
+static void *arena_malloc(arena_t *a, size_t size, size_t align, int zero);
+static void *heap_malloc(size_t size);
+static void *heap_calloc(size_t size);
+static void *heap_memalign(size_t size, size_t align);
+static size_t heap_malloc_batch(size_t size, size_t n, void **out);
+static void heap_free(void *bp);
+static void heap_free_block(void *bp);
+static size_t heap_free_run(void **ptrs, size_t n);
+static void *heap_realloc(void *ptr, size_t size);
+static size_t largest_free(void);
+#if BIN_LOCKING
+static void bin_lock(int cls);
+static void bin_unlock(int cls);
+#endif
+#if TCACHE
+static void tcache_check(void);
+static void *tcache_alloc(arena_t *a, int cls);
+static void tcache_free(void *obj, int cls);
+static void tcache_spill(int cls, int n);
+static void tcache_flush(void);
+#endif
 static void *extend_heap(size_t words);
 static void *find_fit(size_t asize);
 static void place(void *bp, size_t asize);
+static void place_run(void *bp, size_t asize, size_t n, void **out);
+static size_t adjust_size(size_t size);
+static void trim_block(void *bp, size_t asize);
+static void grow_track(void *bp, size_t need);
+static void grow_untrack(void *bp, int trim);
+static size_t grow_lookup(void *bp);
+static int grow_reclaim(void);
+static void *alloc_aligned(size_t asize, size_t align);
+#if USE_QUICK
+static int quick_consolidate(void);
+#endif
+#if USE_SLAB
+static int slab_class(void *p);
+static void *slab_alloc(size_t size);
+static void slab_free(void *p, int cls);
+#endif
+static void pool_link(pool_page_t **head, pool_page_t *pg);
+static void pool_unlink(pool_page_t **head, pool_page_t *pg);
 static void *coalesce(void *bp);
+static void heap_trim(void *bp);
+static size_t mapped_size(size_t size, size_t off);
+static void *mapped_alloc(size_t size, size_t align);
+static void *mapped_resize(void *bp, size_t size);
 static int mm_check(void);
 static void removeBlock(void *bp);
 static void insertBlock(void *bp);
+#if FIT_POLICY == FIT_TLSF
+static char **list_head(size_t size);
+static void tlsf_mapping(size_t size, int *fl, int *sl);
+#elif FIT_POLICY == FIT_ADDRORDER
+static void skip_insert(char *bp);
+static void skip_remove(char *bp);
+#else
+static char **list_head(size_t size);
+static int size_class(size_t size);
+static void tree_insert(char *bp);
+static void tree_remove(char *bp);
+static void *tree_best_fit(size_t asize);
+#endif
 
 /* Forward declarations for check functions */
+static int check_slice(size_t budget);
+static char *check_next(char *bp, int list);
 static int checkBlockHFA(void *bp);
 static int checkBlocksOverlap(void *bp);
 static int checkBlockEscapedCoalesce(void *bp);
 static int checkBlockOutOfBounds(void *bp);
+static int checkBlockLinked(void *bp);
+static int checkFreeNode(void *bp, int list);
+static int checkTotals(size_t count, size_t bytes, const char *walk);
 
 
 /*
     As of right now this implementation uses:
-        1. Implicit Free List structure
-        2. First-fit free block finding
+        1. Segregated explicit free lists, one per power-of-two size class
+           (or a two-level TLSF index when FIT_POLICY is FIT_TLSF, or one
+           address-ordered skip list when it is FIT_ADDRORDER)
+        2. First-fit within a class, falling through to the next
+           non-empty larger class
         3. Immediate coalescing of free blocks
- 
-    Once working, next thing to try is:
-        1. Next-fit free block finding
+        4. A separate mapping for every request of MMAP_THRESHOLD bytes or more
+        5. MM_ARENAS independent arenas, each with its own lock under
+           MM_THREADS, plus per-thread caches of slab objects, or else
+           (MM_BINLOCKS) one shared heap with a lock per slab class
 */
 
 /*
- * mm_init - initialize the malloc package.
+ * mm_init - initialize the malloc package: split the heap into MM_ARENAS
+ *     regions and lay out arena 0. The other arenas are laid out the
+ *     first time a thread allocates from them.
  */
 int mm_init(void)
 {
-    if ((heap_listp = mem_sbrk(2*MIN_BLOCK_SIZE)) == (void *)-1)
+    int i, ret;
+#if MM_THREADS
+    static int locks_ready = 0;
+#endif
+    
+    if (mem_set_arenas(MM_ARENAS) < 0)
         return -1;
-    PUT(heap_listp, 0);                                                     /* Alignment padding */
-    PUT(heap_listp + (1*WSIZE), PACK(MIN_BLOCK_SIZE, 1));                   /* Prologue header */
+    heap_base = mem_heap_lo();
+    arena_span = (MM_ARENAS > 1) ? (size_t)((char *)mem_arena_lo(1) - heap_base) : MAX_HEAP;
+#if USE_SLAB
+    memset(slab_map, 0, sizeof(slab_map));
+#endif
+    for (i = 0; i < MM_ARENAS; i++) {
+        arenas[i].heap_listp = 0;
+        arenas[i].id = i;
+        arenas[i].mallocs = 0;
+        arenas[i].frees = 0;
+        arenas[i].contended = 0;
+        memset(&arenas[i].ctr, 0, sizeof(arenas[i].ctr));
+        memset(&arenas[i].chk, 0, sizeof(arenas[i].chk));
+        arenas[i].chk.list = -1;
+#if MM_THREADS
+        if (!locks_ready)
+            pthread_mutex_init(&arenas[i].lock, NULL);
+        arenas[i].remote_head = NULL;
+        arenas[i].remote_frees = 0;
+#endif
+    }
+#if BIN_LOCKING
+    for (i = 1; i <= SLAB_CLASSES; i++) {
+        if (!locks_ready)
+            pthread_mutex_init(&bins[i].lock, NULL);
+        bins[i].acquires = 0;
+        bins[i].spins = 0;
+        bins[i].sleeps = 0;
+    }
+#endif
+#if MM_THREADS
+    locks_ready = 1;
+#endif
+    
+    arena_lock(&arenas[0]);
+    ret = heap_init();
+    arena_unlock(&arenas[0]);
+#if TCACHE
+    heap_epoch++;
+#endif
+    return ret;
+}
+
+/*
+ * mm_malloc - Serve small requests from the thread cache or under their
+ *     bin's lock when the build has either, and everything else from the
+ *     thread's arena, falling back on the other arenas when its region is
+ *     full.
+ */
+void *mm_malloc(size_t size)
+{
+    arena_t *a = arena_pick();
+#if TCACHE || BIN_LOCKING
+    void *bp;
+#endif
+    
+#if TCACHE
+    if (size != 0 && size <= SLAB_MAX && (bp = tcache_alloc(a, SLAB_CLASS(size))) != NULL)
+        return bp;
+#elif BIN_LOCKING
+    if (size != 0 && size <= SLAB_MAX) {
+        int cls = SLAB_CLASS(size);
+        
+        bin_lock(cls);
+        ar = a;
+        bp = slab_alloc(size);
+        bin_unlock(cls);
+        if (bp != NULL)
+            return bp;
+    }
+#endif
+    return arena_malloc(a, size, ALIGNMENT, 0);
+}
+
+/*
+ * mm_calloc - Allocate a zeroed array of nmemb elements of size bytes
+ *     each, or return NULL if the total does not fit in a size_t.
+ */
+void *mm_calloc(size_t nmemb, size_t size)
+{
+    void *bp;
+    
+    if (size != 0 && nmemb > (size_t)-1 / size)
+        return NULL;
+    size *= nmemb;
+    
+    /* Small blocks are cheaper to clear than to work out what needs clearing */
+    if (size <= SLAB_MAX) {
+        if ((bp = mm_malloc(size)) != NULL)
+            memset(bp, 0, size);
+        return bp;
+    }
+    return arena_malloc(arena_pick(), size, ALIGNMENT, 1);
+}
+
+/*
+ * mm_memalign - Allocate size bytes at an address that is a multiple of
+ *     alignment, which must be a power of two. Returns NULL if it is
+ *     not. The block is freed and resized like any other.
+ */
+void *mm_memalign(size_t alignment, size_t size)
+{
+    if (alignment == 0 || (alignment & (alignment - 1)) != 0)
+        return NULL;
+    
+    /* Only objects of DSIZE or less get slots that are merely DSIZE-aligned */
+    if (alignment <= BLOCK_ALIGN)
+        return mm_malloc(size != 0 && size < alignment ? alignment : size);
+    return arena_malloc(arena_pick(), size, alignment, 0);
+}
+
+/*
+ * mm_aligned_alloc - ISO C's name for mm_memalign.
+ */
+void *mm_aligned_alloc(size_t alignment, size_t size)
+{
+    return mm_memalign(alignment, size);
+}
+
+/*
+ * mm_malloc_batch - Allocate up to n blocks of size bytes each into out,
+ *     returning how many were allocated. Heap-sized requests are carved
+ *     back to back out of each free block the search turns up, under a
+ *     single lock, so the search, split and locking happen once per
+ *     free block rather than once per block.
+ */
+size_t mm_malloc_batch(size_t size, size_t n, void **out)
+{
+    arena_t *a = arena_pick();
+    size_t got = 0;
+    
+    if (size == 0)
+        return 0;
+#if TCACHE || BIN_LOCKING
+    /* The thread cache and the bins already hand out small objects cheaply */
+    if (size <= SLAB_MAX) {
+        while (got < n && (out[got] = mm_malloc(size)) != NULL)
+            got++;
+        return got;
+    }
+#endif
+    arena_lock(a);
+#if MM_THREADS
+    remote_drain(a);
+#endif
+    got = heap_malloc_batch(size, n, out);
+    a->mallocs += got;
+    arena_unlock(a);
+    
+    /* The thread's region is full -> the rest one at a time from the others */
+    while (got < n && (out[got] = arena_malloc(a, size, ALIGNMENT, 0)) != NULL)
+        got++;
+    return got;
+}
+
+/*
+ * mm_free - Return slab objects to the thread cache or to their bin when
+ *     the build has either, and everything else to the arena whose region holds it: directly
+ *     if it is the thread's own arena, through the arena's remote-free
+ *     queue if not.
+ */
+void mm_free(void *bp)
+{
+    arena_t *a;
+#if TCACHE
+    int cls;
+    
+    if (heap_base != NULL && (cls = slab_class(bp)) != 0) {
+        tcache_free(bp, cls);
+        return;
+    }
+#elif BIN_LOCKING
+    int cls;
+    
+    if (heap_base != NULL && (cls = slab_class(bp)) != 0) {
+        bin_lock(cls);
+        ar = &arenas[0];
+        slab_free(bp, cls);
+        bin_unlock(cls);
+        return;
+    }
+#endif
+    if (IS_MAPPED(bp))
+        a = arena_pick();
+    else {
+        a = ARENA_OF(bp);
+#if MM_THREADS
+        if (a != arena_pick()) {
+            remote_push(a, bp);
+            return;
+        }
+#endif
+    }
+    arena_lock(a);
+    heap_free(bp);
+    a->frees++;
+    arena_unlock(a);
+}
+
+/*
+ * mm_free_sized - mm_free for a caller that knows the size it asked for
+ *     (or last realloc'd to). Slab objects never hold more than SLAB_MAX
+ *     bytes, so above that the slab page lookup is skipped. At SLAB_MAX
+ *     or less the size does not say where the object lives: realloc
+ *     shrinks slab objects and heap blocks in place, and a small request
+ *     falls back on the heap when no slab page can be had. Those frees
+ *     take the mm_free path, slab_map lookup and all, and save nothing
+ *     over mm_free. A mapping may be shrunk below MMAP_THRESHOLD in
+ *     place, so mapped blocks are still told apart by address.
+ */
+void mm_free_sized(void *ptr, size_t size)
+{
+    arena_t *a;
+    
+    if (ptr == NULL || size <= SLAB_MAX || IS_MAPPED(ptr)) {
+        mm_free(ptr);
+        return;
+    }
+    a = ARENA_OF(ptr);
+#if MM_THREADS
+    if (a != arena_pick()) {
+        remote_push(a, ptr);
+        return;
+    }
+#endif
+    arena_lock(a);
+    heap_free_block(ptr);
+    a->frees++;
+    arena_unlock(a);
+}
+
+/*
+ * mm_free_batch - Free the n blocks in ptrs, skipping NULLs. The thread's
+ *     own heap blocks are freed under one hold of its arena lock, and runs
+ *     of them that sit back to back in memory, as a batch from
+ *     mm_malloc_batch does, are merged and coalesced once as a single block.
+ */
+void mm_free_batch(void **ptrs, size_t n)
+{
+    arena_t *a = arena_pick();
+    arena_t *locked = NULL;
+    size_t i = 0, run;
+    char *bp;
+    
+    while (i < n) {
+        bp = ptrs[i];
+        
+        /* Anything that is not one of our heap blocks takes the mm_free path */
+        if (bp == NULL || IS_MAPPED(bp) || ARENA_OF(bp) != a
+#if USE_SLAB
+            || (heap_base != NULL && slab_class(bp) != 0)
+#endif
+            ) {
+            if (locked != NULL) {
+                arena_unlock(locked);
+                locked = NULL;
+            }
+            if (bp != NULL)
+                mm_free(bp);
+            i++;
+            continue;
+        }
+        if (locked == NULL) {
+            arena_lock(a);
+            locked = a;
+        }
+        run = heap_free_run(ptrs + i, n - i);
+        a->frees += run;
+        i += run;
+    }
+    if (locked != NULL)
+        arena_unlock(locked);
+}
+
+/*
+ * mm_usable_size - Return how many bytes the block at ptr can hold, which
+ *     may be more than were asked for, or 0 if ptr is NULL. Slack a
+ *     growing block holds for later reallocs does not count, since it can
+ *     be taken back.
+ */
+size_t mm_usable_size(void *ptr)
+{
+    arena_t *a;
+    size_t size;
+    
+    if (ptr == NULL)
+        return 0;
+#if USE_SLAB
+    int cls;
+    if (heap_base != NULL && (cls = slab_class(ptr)) != 0)
+        return cls * DSIZE;
+#endif
+    if (IS_MAPPED(ptr))
+        return MAPPED_LEN(ptr) - MAPPED_OFF(ptr);
+    
+    /* Neighbouring frees rewrite the header's flags, so read it under the lock */
+    a = ARENA_OF(ptr);
+    arena_lock(a);
+    size = GET_GROWING(HDRP(ptr)) ? grow_lookup(ptr) : GET_SIZE(HDRP(ptr));
+    arena_unlock(a);
+    return size - WSIZE;
+}
+
+/*
+ * mm_realloc - Resize a block within the arena that holds it, or move it
+ *     to another arena when its own region is full.
+ */
+void *mm_realloc(void *ptr, size_t size)
+{
+    arena_t *a = (ptr == NULL || IS_MAPPED(ptr)) ? arena_pick() : ARENA_OF(ptr);
+    void *newptr;
+    
+#if BIN_LOCKING
+    /* Slab objects move outside the heap lock, which no bin lock may nest in */
+    int cls;
+    if (ptr != NULL && heap_base != NULL && (cls = slab_class(ptr)) != 0) {
+        if (size == 0) {
+            mm_free(ptr);
+            return NULL;
+        }
+        if (size <= cls * DSIZE)
+            return ptr;
+        if ((newptr = mm_malloc(size)) != NULL) {
+            memcpy(newptr, ptr, cls * DSIZE);
+            mm_free(ptr);
+        }
+        return newptr;
+    }
+#endif
+    arena_lock(a);
+    newptr = heap_realloc(ptr, size);
+    arena_unlock(a);
+#if MM_ARENAS > 1
+    /* heap_realloc leaves the block alone when it fails, so it can still be copied */
+    if (newptr == NULL && ptr != NULL && size != 0 &&
+        (newptr = arena_malloc(arena_pick(), size, ALIGNMENT, 0)) != NULL) {
+        memcpy(newptr, ptr, MIN(mm_usable_size(ptr), size));
+        mm_free(ptr);
+    }
+#endif
+    return newptr;
+}
+
+/*
+ * mm_region_create - Make an empty region, or return NULL if there is no
+ *     room for its first chunk. A region is for one thread at a time.
+ */
+mm_region_t *mm_region_create(void)
+{
+    mm_region_t *r;
+    
+    if ((r = mm_malloc(REGION_CHUNK)) == NULL)
+        return NULL;
+    r->chunks = NULL;
+    r->bump = (char *)r + ALIGN(sizeof(mm_region_t));
+    r->end = (char *)r + REGION_CHUNK;
+    return r;
+}
+
+/*
+ * mm_region_alloc - Allocate size bytes from region r by bumping a
+ *     pointer, taking a new chunk from mm_malloc when the current one is
+ *     full. The block cannot be freed or resized on its own; it goes when
+ *     the region is reset or destroyed.
+ */
+void *mm_region_alloc(mm_region_t *r, size_t size)
+{
+    char *chunk;
+    
+    if (size == 0 || size > (size_t)-1 - REGION_CHUNK)
+        return NULL;
+    size = ALIGN(size);
+    if (size <= (size_t)(r->end - r->bump)) {
+        r->bump += size;
+        return r->bump - size;
+    }
+    
+    /* Big requests leave the current chunk to carry on */
+    if ((chunk = mm_malloc(size > REGION_BIG ? REGION_HDR + size : REGION_CHUNK)) == NULL)
+        return NULL;
+    *(char **)chunk = r->chunks;
+    r->chunks = chunk;
+    if (size <= REGION_BIG) {
+        r->bump = chunk + REGION_HDR + size;
+        r->end = chunk + REGION_CHUNK;
+    }
+    return chunk + REGION_HDR;
+}
+
+/*
+ * mm_region_reset - Free everything allocated from region r at once,
+ *     leaving it empty. Only the chunks past the first go back to the
+ *     heap, so resetting a region that never outgrew its first chunk
+ *     costs nothing more than rewinding the bump pointer.
+ */
+void mm_region_reset(mm_region_t *r)
+{
+    char *chunk;
+    
+    while ((chunk = r->chunks) != NULL) {
+        r->chunks = *(char **)chunk;
+        mm_free(chunk);
+    }
+    r->bump = (char *)r + ALIGN(sizeof(mm_region_t));
+    r->end = (char *)r + REGION_CHUNK;
+}
+
+/*
+ * mm_region_destroy - Free region r along with everything allocated from it.
+ */
+void mm_region_destroy(mm_region_t *r)
+{
+    if (r == NULL)
+        return;
+    mm_region_reset(r);
+    mm_free(r);
+}
+
+/*
+ * mm_pool_create - Make a pool of objects of objsize bytes, or return NULL
+ *     if objsize is 0 or too big for a page. A pool is for one thread at
+ *     a time.
+ */
+mm_pool_t *mm_pool_create(size_t objsize)
+{
+    mm_pool_t *p;
+    size_t pagesize = POOL_PAGE;
+    
+    if (objsize == 0 || objsize > MAX_HEAP / (2 * POOL_MIN_OBJS))
+        return NULL;
+    objsize = ALIGN(MAX(objsize, sizeof(char *)));
+    while ((pagesize - WSIZE - POOL_HDR) / objsize < POOL_MIN_OBJS)
+        pagesize <<= 1;
+    
+    if ((p = mm_malloc(sizeof(mm_pool_t))) == NULL)
+        return NULL;
+    p->objsize = objsize;
+    p->pagesize = pagesize;
+    p->partial = NULL;
+    p->full = NULL;
+    return p;
+}
+
+/*
+ * mm_pool_get - Take an object from pool p: a freed one if its first page
+ *     with room has one, otherwise the next untouched slot. A new page
+ *     comes from the heap when no page has room.
+ */
+void *mm_pool_get(mm_pool_t *p)
+{
+    pool_page_t *pg = p->partial;
+    char *obj;
+    
+    if (pg == NULL) {
+        if ((pg = mm_memalign(p->pagesize, p->pagesize - WSIZE)) == NULL)
+            return NULL;
+        pg->free = NULL;
+        pg->bump = (char *)pg + POOL_HDR;
+        pg->used = 0;
+        pool_link(&p->partial, pg);
+    }
+    
+    if ((obj = pg->free) != NULL)
+        pg->free = *(char **)obj;
+    else {
+        obj = pg->bump;
+        pg->bump += p->objsize;
+    }
+    pg->used++;
+    
+    if (POOL_PAGE_FULL(p, pg)) {
+        pool_unlink(&p->partial, pg);
+        pool_link(&p->full, pg);
+    }
+    return obj;
+}
+
+/*
+ * mm_pool_put - Give obj back to pool p, which it came from. A page that
+ *     empties goes back to the heap, unless it is the only one the pool
+ *     has room in.
+ */
+void mm_pool_put(mm_pool_t *p, void *obj)
+{
+    pool_page_t *pg;
+    
+    if (obj == NULL)
+        return;
+    pg = POOL_PAGE_OF(obj, p->pagesize);
+    if (POOL_PAGE_FULL(p, pg)) {
+        pool_unlink(&p->full, pg);
+        pool_link(&p->partial, pg);
+    }
+    *(char **)obj = pg->free;
+    pg->free = obj;
+    
+    if (--pg->used == 0 && (p->partial != pg || pg->next != NULL)) {
+        pool_unlink(&p->partial, pg);
+        mm_free(pg);
+    }
+}
+
+/*
+ * mm_pool_destroy - Free pool p and every page it holds, along with any
+ *     objects still taken from it.
+ */
+void mm_pool_destroy(mm_pool_t *p)
+{
+    pool_page_t *pg;
+    
+    if (p == NULL)
+        return;
+    while ((pg = p->partial) != NULL) {
+        p->partial = pg->next;
+        mm_free(pg);
+    }
+    while ((pg = p->full) != NULL) {
+        p->full = pg->next;
+        mm_free(pg);
+    }
+    mm_free(p);
+}
+
+/*
+ * mm_arena_count - Return the number of arenas the heap is split into.
+ */
+int mm_arena_count(void)
+{
+    return MM_ARENAS;
+}
+
+/*
+ * mm_arena_stats - Fill in the counters of one arena. Returns 0, or -1
+ *     if there is no such arena.
+ */
+int mm_arena_stats(int arena, mm_arena_stats_t *stats)
+{
+    arena_t *a;
+    
+    if (arena < 0 || arena >= MM_ARENAS)
+        return -1;
+    a = &arenas[arena];
+    arena_lock(a);
+    stats->heapsize = (a->heap_listp != 0) ? mem_arena_heapsize(arena) : 0;
+    stats->mallocs = a->mallocs;
+    stats->frees = a->frees;
+    stats->contended = a->contended;
+#if MM_THREADS
+    stats->threads = a->threads;
+    stats->remote_frees = a->remote_frees;
+#else
+    stats->threads = 1;
+    stats->remote_frees = 0;
+#endif
+    arena_unlock(a);
+    return 0;
+}
+
+/*
+ * mm_stats - Fill in the heap counters, summed over every arena. Live
+ *     bytes are the arenas' heaps and the mappings, less the free blocks
+ *     (quick-listed ones included) and each heap's prologue and
+ *     epilogue, so slab pages and realloc slack count as live.
+ */
+void mm_stats(mm_stats_t *stats)
+{
+    arena_t *a;
+    int i, k;
+    
+    memset(stats, 0, sizeof(*stats));
+    for (i = 0; i < MM_ARENAS; i++) {
+        a = &arenas[i];
+        arena_lock(a);
+        if (a->heap_listp != 0) {
+            stats->live_bytes += mem_arena_heapsize(i) - 4*WSIZE
+                - a->ctr.free_bytes - a->ctr.quick_bytes;
+            stats->largest_free = MAX(stats->largest_free, largest_free());
+        }
+        stats->free_bytes += a->ctr.free_bytes + a->ctr.quick_bytes;
+        for (k = 0; k < MM_STATS_CLASSES; k++)
+            stats->free_blocks[k] += a->ctr.free_count[k];
+        stats->sbrk_calls += a->ctr.sbrks;
+        for (k = 0; k < 4; k++)
+            stats->coalesce[k] += a->ctr.coalesces[k];
+        stats->fit_searches += a->ctr.fit_searches;
+        stats->fit_probes += a->ctr.fit_probes;
+        arena_unlock(a);
+    }
+    stats->live_bytes += mem_mapsize();
+}
+
+/*
+ * mm_check_slice - Check the next stretch of one arena's heap and free
+ *     index, up to budget blocks and nodes, taking the arenas in turn.
+ *     Each arena's check resumes where its last one stopped. Returns 0
+ *     if what it saw is consistent, and -1, after printing the problem,
+ *     if not.
+ */
+int mm_check_slice(size_t budget)
+{
+    static unsigned int turn;
+    arena_t *a = &arenas[__atomic_fetch_add(&turn, 1, __ATOMIC_RELAXED) % MM_ARENAS];
+    int ok;
+    
+    arena_lock(a);
+    ok = check_slice(budget);
+    arena_unlock(a);
+    return ok ? 0 : -1;
+}
+
+/*
+ * mm_bin_count - Return the number of bins with locks of their own: the
+ *     slab classes under MM_BINLOCKS, none otherwise.
+ */
+int mm_bin_count(void)
+{
+#if BIN_LOCKING
+    return SLAB_CLASSES;
+#else
+    return 0;
+#endif
+}
+
+/*
+ * mm_bin_stats - Fill in the lock counters of one bin. Returns 0, or -1
+ *     if there is no such bin.
+ */
+int mm_bin_stats(int bin, mm_bin_stats_t *stats)
+{
+#if BIN_LOCKING
+    bin_t *b;
+    
+    if (bin < 0 || bin >= SLAB_CLASSES)
+        return -1;
+    b = &bins[bin + 1];
+    pthread_mutex_lock(&b->lock);
+    stats->objsize = (bin + 1) * DSIZE;
+    stats->acquires = b->acquires;
+    stats->spins = b->spins;
+    stats->sleeps = b->sleeps;
+    pthread_mutex_unlock(&b->lock);
+    return 0;
+#else
+    (void)bin;
+    (void)stats;
+    return -1;
+#endif
+}
+
+/*
+ * mm_fork_prepare, mm_fork_parent, mm_fork_child - pthread_atfork handlers
+ *     for a process that uses the package as its malloc. Every lock is
+ *     taken before the fork, in lock order, so the child gets a heap no
+ *     other thread was in the middle of changing. The parent releases
+ *     them; the child, which has only the forking thread, starts them
+ *     over. Other threads' cached slab objects are lost to the child.
+ */
+void mm_fork_prepare(void)
+{
+#if MM_THREADS
+    int i;
+    
+    pthread_mutex_lock(&assign_lock);
+#if BIN_LOCKING
+    for (i = 1; i <= SLAB_CLASSES; i++)
+        pthread_mutex_lock(&bins[i].lock);
+#endif
+    for (i = 0; i < MM_ARENAS; i++)
+        pthread_mutex_lock(&arenas[i].lock);
+#endif
+    mem_fork_prepare();
+}
+
+void mm_fork_parent(void)
+{
+#if MM_THREADS
+    int i;
+    
+#endif
+    mem_fork_parent();
+#if MM_THREADS
+    for (i = MM_ARENAS - 1; i >= 0; i--)
+        pthread_mutex_unlock(&arenas[i].lock);
+#if BIN_LOCKING
+    for (i = SLAB_CLASSES; i >= 1; i--)
+        pthread_mutex_unlock(&bins[i].lock);
+#endif
+    pthread_mutex_unlock(&assign_lock);
+#endif
+}
+
+void mm_fork_child(void)
+{
+#if MM_THREADS
+    int i;
+    
+#endif
+    mem_fork_child();
+#if MM_THREADS
+    for (i = 0; i < MM_ARENAS; i++) {
+        pthread_mutex_init(&arenas[i].lock, NULL);
+        arenas[i].threads = (&arenas[i] == my_arena);
+    }
+#if BIN_LOCKING
+    for (i = 1; i <= SLAB_CLASSES; i++)
+        pthread_mutex_init(&bins[i].lock, NULL);
+#endif
+    pthread_mutex_init(&assign_lock, NULL);
+#endif
+}
+
+/*
+ * Allocate from arena a, or from the others in turn once its region is
+ * full: aligned to align if that is above BLOCK_ALIGN, zeroed if zero is set.
+ */
+static void *arena_malloc(arena_t *a, size_t size, size_t align, int zero) {
+    arena_t *b;
+    void *bp;
+    int i;
+    
+    for (i = 0; i < MM_ARENAS; i++) {
+        b = &arenas[(a->id + i) % MM_ARENAS];
+        arena_lock(b);
+#if MM_THREADS
+        remote_drain(b);
+#endif
+#if MM_ARENAS > 1
+        ar_last = (i == MM_ARENAS - 1);
+#endif
+        if (align > BLOCK_ALIGN)
+            bp = heap_memalign(size, align);
+        else if (zero)
+            bp = heap_calloc(size);
+        else
+            bp = heap_malloc(size);
+#if MM_ARENAS > 1
+        ar_last = 0;
+#endif
+        if (bp != NULL)
+            b->mallocs++;
+        arena_unlock(b);
+        if (bp != NULL || size == 0)
+            return bp;
+    }
+    return NULL;
+}
+
+/* Return the calling thread's arena, assigning the least loaded one on first use */
+static arena_t *arena_pick(void) {
+#if MM_THREADS
+    arena_t *a;
+    int i;
+    
+    if ((a = my_arena) != NULL)
+        return a;
+    pthread_once(&thread_once, thread_key_init);
+    pthread_mutex_lock(&assign_lock);
+    a = &arenas[0];
+    for (i = 1; i < MM_ARENAS; i++)
+        if (arenas[i].threads < a->threads)
+            a = &arenas[i];
+    a->threads++;
+    pthread_mutex_unlock(&assign_lock);
+    pthread_setspecific(thread_key, a);
+    my_arena = a;
+    return a;
+#else
+    return &arenas[0];
+#endif
+}
+
+/* Lock an arena and make it the one the heap_* functions work on */
+static void arena_lock(arena_t *a) {
+#if MM_THREADS
+    if (pthread_mutex_trylock(&a->lock) != 0) {
+        pthread_mutex_lock(&a->lock);
+        a->contended++;
+    }
+#endif
+    ar = a;
+}
+
+static void arena_unlock(arena_t *a) {
+#if MM_THREADS
+    pthread_mutex_unlock(&a->lock);
+#else
+    (void)a;
+#endif
+}
+
+#if BIN_LOCKING
+/* Lock a bin, spinning on trylock for a while before sleeping */
+static void bin_lock(int cls) {
+    bin_t *b = &bins[cls];
+    size_t spins = 0;
+    
+    while (pthread_mutex_trylock(&b->lock) != 0) {
+        if (++spins == BIN_SPINS) {
+            pthread_mutex_lock(&b->lock);
+            b->sleeps++;
+            break;
+        }
+    }
+    b->acquires++;
+    b->spins += spins;
+}
+
+static void bin_unlock(int cls) {
+    pthread_mutex_unlock(&bins[cls].lock);
+}
+#endif
+
+#if MM_THREADS
+/* Create the key whose destructor notices a thread exit */
+static void thread_key_init(void) {
+    pthread_key_create(&thread_key, thread_exit);
+}
+
+/* A thread is exiting: flush its cache and release its arena */
+static void thread_exit(void *arg) {
+    arena_t *a = (arena_t *)arg;
+    
+#if TCACHE
+    tcache_flush();
+#endif
+    pthread_mutex_lock(&assign_lock);
+    a->threads--;
+    pthread_mutex_unlock(&assign_lock);
+}
+
+/* Push a block onto another arena's remote-free queue, without its lock */
+static void remote_push(arena_t *a, void *bp) {
+    char *head = __atomic_load_n(&a->remote_head, __ATOMIC_RELAXED);
+    
+    do {
+        *(char **)bp = head;
+    } while (!__atomic_compare_exchange_n(&a->remote_head, &head, (char *)bp, 1,
+                                          __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+/* Free every block on a locked arena's remote-free queue */
+static void remote_drain(arena_t *a) {
+    char *bp, *next;
+    
+    if (__atomic_load_n(&a->remote_head, __ATOMIC_RELAXED) == NULL)
+        return;
+    for (bp = __atomic_exchange_n(&a->remote_head, NULL, __ATOMIC_ACQUIRE); bp != NULL; bp = next) {
+        next = *(char **)bp;
+        heap_free(bp);
+        a->frees++;
+        a->remote_frees++;
+    }
+}
+#endif
+
+/*
+ * heap_init - Lay out an empty heap: prologue, epilogue and one free chunk.
+ */
+static int heap_init(void)
+{
+    ar->ctr.sbrks++;
+    if ((ar->heap_listp = mem_arena_sbrk(ar->id, 4*WSIZE)) == (void *)-1)
+        return -1;
+    PUT(ar->heap_listp, 0);                                     /* Alignment padding */
+    PUT(ar->heap_listp + (1*WSIZE), PACK(DSIZE, 1));            /* Prologue header */
+    PUT(ar->heap_listp + (2*WSIZE), PACK(DSIZE, 1));            /* Prologue footer */
+    PUT(ar->heap_listp + (3*WSIZE), PACK(0, PREV_ALLOC | 1));   /* Epilogue header */
+    ar->heap_listp += (2*WSIZE);
+    
+    /* Every free list starts out empty */
+#if FIT_POLICY == FIT_TLSF
+    memset(ar->tlsf_lists, 0, sizeof(ar->tlsf_lists));
+    memset(ar->sl_bitmap, 0, sizeof(ar->sl_bitmap));
+    ar->fl_bitmap = 0;
+#elif FIT_POLICY == FIT_ADDRORDER
+    memset(ar->skip_head_next, 0, sizeof(ar->skip_head_next));
+    memset(ar->skip_head_span, 0, sizeof(ar->skip_head_span));
+    ar->skip_top = 1;
+    ar->skip_seed = 2463534242U;
+#else
+    memset(ar->seg_lists, 0, sizeof(ar->seg_lists));
+    ar->tree_root = NULL;
+#endif
+    memset(ar->grow_blocks, 0, sizeof(ar->grow_blocks));
+#if USE_QUICK
+    memset(ar->quick_lists, 0, sizeof(ar->quick_lists));
+    ar->quick_count = 0;
+#endif
+#if USE_SLAB
+    memset(ar->slab_partial, 0, sizeof(ar->slab_partial));
+#endif
+    
+    /* Extend the empty heap with a free block of CHUNKSIZE bytes */
+    if (extend_heap(CHUNKSIZE/WSIZE) == NULL)
+        return -1;
+    
+    return 0;
+}
+
+/*
+ * heap_malloc - Allocate a block from the segregated free lists, growing
+ *     the heap when no class holds a large enough block.
+ *     Always allocate a block whose size is a multiple of the alignment.
+ */
+static void *heap_malloc(size_t size)
+{
+    size_t asize;        /* Adjusted block size */
+    size_t extendsize;   /* Amount to extend heap if no fit */
+    char *bp;
+    
+    // Ignore spurious requests
+    if (size == 0)
+        return NULL;
+    
+    /* Lay out the arena's heap on its first allocation */
+    if (ar->heap_listp == 0 && heap_init() < 0)
+        return NULL;
+    
+#if USE_SLAB && !BIN_LOCKING
+    /* Small requests come from a slab page (mm_malloc does it under bin locking) */
+    if (size <= SLAB_MAX && (bp = slab_alloc(size)) != NULL)
+        return bp;
+#endif
+    
+    /* Huge requests get a mapping of their own, or the heap if that fails */
+    if (size >= MMAP_THRESHOLD && (bp = mapped_alloc(size, BLOCK_ALIGN)) != NULL)
+        return bp;
+    if (TOO_BIG(size))
+        return NULL;
+    
+    /* Adjust block size to include overhead and alignment reqs */
+    asize = adjust_size(size);
+    
+#if USE_QUICK
+    /* A recently freed block of exactly this size is still marked allocated */
+    if (asize <= QUICK_MAX && (bp = ar->quick_lists[asize / DSIZE]) != NULL) {
+        ar->quick_lists[asize / DSIZE] = GET_PTR(bp);
+        ar->quick_count--;
+        ar->ctr.quick_bytes -= asize;
+        return bp;
+    }
+#endif
+    
+    /* Search the free lists for a fit */
+    if ((bp = find_fit(asize)) != NULL){
+        place(bp, asize);
+        return bp;
+    }
+    
+#if USE_QUICK
+    /* Before growing the heap, coalesce the quick lists and look again */
+    if (quick_consolidate() && (bp = find_fit(asize)) != NULL) {
+        place(bp, asize);
+        return bp;
+    }
+#endif
+    
+    /* No fit found. Get more memory and place block, settling for less
+       than a chunk when that is all the arena has left */
+    extendsize = MAX(asize, MIN(CHUNKSIZE, mem_arena_room(ar->id)));
+    if ((bp = extend_heap(extendsize/WSIZE)) == NULL) {
+        /* Out of memory -> give back realloc slack and try once more */
+        if (!grow_reclaim() || (bp = find_fit(asize)) == NULL)
+            return NULL;
+    }
+    place(bp, asize);
+    return bp;
+}
+
+/*
+ * heap_calloc - Allocate a zeroed block. mem_sbrk hands out zeroed
+ *     memory, so the part of a block past the brk as it was before the
+ *     call only needs the words extend_heap and place wrote there
+ *     cleared: the links at the start of the free block it came from,
+ *     and that block's footer if place did not split it off. Sizes are
+ *     above SLAB_MAX, so the block is never a slab object.
+ */
+static void *heap_calloc(size_t size)
+{
+    char *brk = (char *)mem_arena_hi(ar->id) + 1;
+    char *bp, *ftr;
+    size_t clear = size;
+    
+    if ((bp = heap_malloc(size)) == NULL)
+        return NULL;
+    
+    /* A new mapping is zero already */
+    if (IS_MAPPED(bp))
+        return bp;
+    
+    if (bp + size > brk) {
+        clear = MAX((size_t)(brk - bp), FREE_LINK_BYTES);
+        ftr = bp + GET_SIZE(HDRP(bp)) - DSIZE;
+        if (ftr < bp + size)
+            PUT(ftr, 0);
+    }
+    memset(bp, 0, MIN(clear, size));
+    return bp;
+}
+
+/*
+ * heap_memalign - Allocate a block whose payload is a multiple of align,
+ *     a power of two above BLOCK_ALIGN. alloc_aligned turns the padding in
+ *     front of the payload into a free block. A page-aligned mapping can
+ *     start its payload anywhere up to a page in, so huge requests with
+ *     no more than page alignment still get one.
+ */
+static void *heap_memalign(size_t size, size_t align)
+{
+    char *bp;
+    
+    if (size == 0)
+        return NULL;
+    if (size >= MMAP_THRESHOLD && align <= mem_pagesize() &&
+        (bp = mapped_alloc(size, align)) != NULL)
+        return bp;
+    if (TOO_BIG(size) || TOO_BIG(align))
+        return NULL;
+    if (ar->heap_listp == 0 && heap_init() < 0)
+        return NULL;
+    return alloc_aligned(adjust_size(size), align);
+}
+
+/*
+ * heap_malloc_batch - Allocate up to n blocks of size bytes each into out.
+ *     Blocks waiting on the quick list for this size go first. The rest
+ *     are carved from the best fit for one block, as many as it holds,
+ *     and from the next fit after that; when nothing fits the heap grows
+ *     by enough for every block still missing. Once it cannot grow,
+ *     heap_malloc has a go a block at a time, reclaiming realloc slack.
+ */
+static size_t heap_malloc_batch(size_t size, size_t n, void **out)
+{
+    size_t asize, want, got = 0;
+    char *bp;
+    
+    if (ar->heap_listp == 0 && heap_init() < 0)
+        return 0;
+    
+    /* Slab objects and mappings have nothing to share between them */
+    if (size <= SLAB_MAX || size >= MMAP_THRESHOLD) {
+        while (got < n && (out[got] = heap_malloc(size)) != NULL)
+            got++;
+        return got;
+    }
+    
+    asize = adjust_size(size);
+    
+#if USE_QUICK
+    if (asize <= QUICK_MAX) {
+        while (got < n && (bp = ar->quick_lists[asize / DSIZE]) != NULL) {
+            ar->quick_lists[asize / DSIZE] = GET_PTR(bp);
+            ar->quick_count--;
+            ar->ctr.quick_bytes -= asize;
+            out[got++] = bp;
+        }
+    }
+#endif
+    
+    /* Each fit holds as many of the blocks as it has room for */
+    while (got < n) {
+        want = MIN(n - got, MAX_HEAP / asize);
+        bp = find_fit(asize);
+#if USE_QUICK
+        if (bp == NULL && quick_consolidate())
+            bp = find_fit(asize);
+#endif
+        if (bp == NULL && (bp = extend_heap(MAX(want * asize, CHUNKSIZE)/WSIZE)) == NULL)
+            break;
+        want = MIN(want, GET_SIZE(HDRP(bp)) / asize);
+        place_run(bp, asize, want, out + got);
+        got += want;
+    }
+    
+    while (got < n && (out[got] = heap_malloc(size)) != NULL)
+        got++;
+    return got;
+}
+
+/*
+ * heap_free - Hand slab objects and mapped blocks back to where they came
+ *     from, and free heap blocks with heap_free_block.
+ */
+static void heap_free(void *bp)
+{
+    if (ar->heap_listp == 0)
+        heap_init();
+    
+#if USE_SLAB
+    /* Slab objects have no header -- their page says how big they are */
+    int cls;
+    if ((cls = slab_class(bp)) != 0) {
+        slab_free(bp, cls);
+        return;
+    }
+#endif
+    
+    /* Mapped blocks go straight back to memlib */
+    if (IS_MAPPED(bp)) {
+        mem_unmap(MAPPED_BASE(bp));
+        return;
+    }
+    
+    heap_free_block(bp);
+}
+
+/*
+ * heap_free_block - Mark the heap block free and coalesce it with its
+ *     neighbours.
+ */
+static void heap_free_block(void *bp)
+{
+    size_t size = GET_SIZE(HDRP(bp));
+    
+    /* Any realloc slack goes back along with the rest of the block */
+    if (GET_GROWING(HDRP(bp)))
+        grow_untrack(bp, 0);
+    
+#if USE_QUICK
+    /* Small blocks wait on a quick list, still marked allocated */
+    if (size <= QUICK_MAX) {
+        PUT_PTR(bp, ar->quick_lists[size / DSIZE]);
+        ar->quick_lists[size / DSIZE] = bp;
+        ar->quick_count++;
+        ar->ctr.quick_bytes += size;
+        return;
+    }
+#endif
+    
+    PUT(HDRP(bp), PACK(size, GET_PREV_ALLOC(HDRP(bp))));
+    PUT(FTRP(bp), PACK(size, 0));
+    
+    /* This immediately coalesces when a block is freed */
+    heap_trim(coalesce(bp));
+}
+
+/*
+ * heap_free_run - Free ptrs[0], along with the blocks after it in ptrs
+ *     for as long as each one starts where the one before it ends. A run
+ *     of more than one block is marked free as a whole and coalesced
+ *     once. Returns how many blocks it freed. The caller has checked that
+ *     ptrs[0] is a heap block of this arena.
+ */
+static size_t heap_free_run(void **ptrs, size_t n)
+{
+    char *bp = ptrs[0];
+    char *end = NEXT_BLKP(bp);
+    size_t i, size;
+    
+    for (i = 1; i < n && (char *)ptrs[i] == end; i++) {
+#if USE_SLAB
+        if (slab_class(end) != 0)
+            break;
+#endif
+        end = NEXT_BLKP(end);
+    }
+    if (i == 1) {
+        heap_free_block(bp);
+        return 1;
+    }
+    
+    /* Drop any block of the run from the grow table before it disappears */
+    for (size = 0; size < i; size++)
+        if (GET_GROWING(HDRP(ptrs[size])))
+            grow_untrack(ptrs[size], 0);
+    
+    size = end - bp;
+    PUT(HDRP(bp), PACK(size, GET_PREV_ALLOC(HDRP(bp))));
+    PUT(FTRP(bp), PACK(size, 0));
+    heap_trim(coalesce(bp));
+    return i;
+}
+
+/*
+ * heap_realloc - Resize the block in place whenever possible: shrink by
+ *     splitting off the tail, grow into a free next block, or grow at the
+ *     end of the heap by asking mem_sbrk for only the missing bytes.
+ *     Copying to a new block is the last resort. A block grown for the
+ *     second time is treated as a growing buffer and gets geometric slack,
+ *     so that the reallocs after it land in place.
+ */
+static void *heap_realloc(void *ptr, size_t size)
+{
+    void *oldptr = ptr;
+    void *newptr;
+    char *next;
+    size_t copySize;
+    size_t asize;        /* Adjusted block size */
+    size_t csize;        /* Current block size */
+    size_t avail;        /* Bytes available in place (block + free next block) */
+    size_t target;       /* Block size to grow to, including any slack */
+    
+    if (ptr == NULL)
+        return heap_malloc(size);
+    if (size == 0) {
+        heap_free(ptr);
+        return NULL;
+    }
+    
+#if USE_SLAB
+    /* A slab object stays put while it fits its slot, and moves otherwise */
+    int cls;
+    if ((cls = slab_class(oldptr)) != 0) {
+        if (size <= cls * DSIZE)
+            return oldptr;
+        if ((newptr = heap_malloc(size)) == NULL)
+            return NULL;
+        memcpy(newptr, oldptr, cls * DSIZE);
+        slab_free(oldptr, cls);
+        return newptr;
+    }
+#endif
+    
+    /* A mapped block is remapped while it stays huge, and moves otherwise */
+    if (IS_MAPPED(oldptr)) {
+        if (size >= MMAP_THRESHOLD && (newptr = mapped_resize(oldptr, size)) != NULL)
+            return newptr;
+        if ((newptr = heap_malloc(size)) == NULL)
+            return NULL;
+        copySize = MAPPED_LEN(oldptr) - MAPPED_OFF(oldptr);
+        if (size < copySize)
+            copySize = size;
+        memcpy(newptr, oldptr, copySize);
+        mem_unmap(MAPPED_BASE(oldptr));
+        return newptr;
+    }
+    
+    /* Too big for the heap -> only a mapping of its own can hold it */
+    if (TOO_BIG(size)) {
+        if ((newptr = heap_malloc(size)) == NULL)
+            return NULL;
+        memcpy(newptr, oldptr, GET_SIZE(HDRP(oldptr)) - WSIZE);
+        heap_free(oldptr);
+        return newptr;
+    }
+    
+    asize = adjust_size(size);
+    csize = GET_SIZE(HDRP(oldptr));
+    
+    if (asize <= csize) {
+        /* Growing buffer still inside its slack -> nothing to do */
+        if (GET_GROWING(HDRP(oldptr))) {
+            grow_track(oldptr, asize);
+            return oldptr;
+        }
+        
+        /* Shrinking (or same size) -> give back the tail */
+        trim_block(oldptr, asize);
+        return oldptr;
+    }
+    
+    /* Repeated growth earns 50% headroom over this request */
+    target = asize;
+    if (GET_GROWING(HDRP(oldptr)))
+        target += (asize >> 1) & ~(BLOCK_ALIGN-1);
+    
+    next = NEXT_BLKP(oldptr);
+    avail = csize;
+    if (!GET_ALLOC(HDRP(next)))
+        avail += GET_SIZE(HDRP(next));
+    
+    /* The block (and any free block after it) ends the heap -> extend by the shortfall */
+    if (avail < target &&
+        (GET_SIZE(HDRP(next)) == 0 || (!GET_ALLOC(HDRP(next)) && GET_SIZE(HDRP(NEXT_BLKP(next))) == 0))) {
+        if (extend_heap((target - avail)/WSIZE) != NULL || extend_heap((asize - avail)/WSIZE) != NULL)
+            avail = csize + GET_SIZE(HDRP(next));
+    }
+    
+    /* Growing into the free block after this one */
+    if (avail >= asize) {
+        removeBlock(next);
+        PUT(HDRP(oldptr), PACK(avail, (GET(HDRP(oldptr)) & (PREV_ALLOC | GROWING)) | 1));
+        CHK_ABSORB(oldptr, avail);
+        trim_block(oldptr, MIN(avail, target));
+        grow_track(oldptr, asize);
+        return oldptr;
+    }
+    
+    /* Move the block, bringing its headroom along unless it is becoming a mapping */
+    if (size >= MMAP_THRESHOLD)
+        target = asize;
+    if ((newptr = heap_malloc(target - WSIZE)) == NULL && (newptr = heap_malloc(size)) == NULL)
+      return NULL;
+    copySize = GET_SIZE(HDRP(oldptr)) - WSIZE;      /* heap_malloc may have reclaimed our slack */
+    if (size < copySize)
+      copySize = size;
+    memcpy(newptr, oldptr, copySize);
+    heap_free(oldptr);
+    
+    /* Only ordinary heap blocks have a header to mark as growing */
+    if (IS_MAPPED(newptr))
+        return newptr;
+#if USE_SLAB
+    if (slab_class(newptr))
+        return newptr;
+#endif
+    grow_track(newptr, asize);
+    return newptr;
+}
+
+/*
+ * Mark bp as a growing block that needs only need bytes, recording it in
+ * the grow table. A full table evicts one entry, trimming off its slack.
+ */
+static void grow_track(void *bp, size_t need) {
+    int i, slot = -1;
+    
+    for (i = 0; i < GROW_SLOTS; i++) {
+        if (ar->grow_blocks[i] == bp) {
+            ar->grow_need[i] = need;
+            return;
+        }
+        if (ar->grow_blocks[i] == NULL)
+            slot = i;
+    }
+    if (slot < 0) {
+        slot = ar->grow_victim;
+        ar->grow_victim = (ar->grow_victim + 1) % GROW_SLOTS;
+        grow_untrack(ar->grow_blocks[slot], 1);
+    }
+    ar->grow_blocks[slot] = bp;
+    ar->grow_need[slot] = need;
+    PUT(HDRP(bp), GET(HDRP(bp)) | GROWING);
+}
+
+/* Forget a growing block, optionally trimming it back to the size it needs */
+static void grow_untrack(void *bp, int trim) {
+    int i;
+    
+    for (i = 0; i < GROW_SLOTS; i++) {
+        if (ar->grow_blocks[i] == bp) {
+            ar->grow_blocks[i] = NULL;
+            PUT(HDRP(bp), GET(HDRP(bp)) & ~GROWING);
+            if (trim)
+                trim_block(bp, ar->grow_need[i]);
+            return;
+        }
+    }
+}
+
+/* Return the block size a growing block actually needs */
+static size_t grow_lookup(void *bp) {
+    int i;
+    
+    for (i = 0; i < GROW_SLOTS; i++)
+        if (ar->grow_blocks[i] == bp)
+            return ar->grow_need[i];
+    return GET_SIZE(HDRP(bp));
+}
+
+/* Trim the slack off every growing block; returns 1 if there were any */
+static int grow_reclaim(void) {
+    int i, found = 0;
+    
+    for (i = 0; i < GROW_SLOTS; i++) {
+        if (ar->grow_blocks[i] != NULL) {
+            grow_untrack(ar->grow_blocks[i], 1);
+            found = 1;
+        }
+    }
+    return found;
+}
+
+/*
+ * Allocate a block of asize bytes whose payload address is a multiple of
+ * align. The search asks for enough room to slide the payload forward;
+ * the skipped front and any unused tail go back to the free lists. When
+ * the heap has to grow, it grows by just enough to reach an aligned
+ * payload past the current brk.
+ */
+static void *alloc_aligned(size_t asize, size_t align) {
+    size_t need = asize + align + MIN_BLOCK_SIZE;
+    size_t csize, pad;
+    char *bp;
+    
+#if USE_QUICK
+    if ((bp = find_fit(need)) == NULL && quick_consolidate())
+        bp = find_fit(need);
+    if (bp == NULL) {
+#else
+    if ((bp = find_fit(need)) == NULL) {
+#endif
+        bp = (char *)mem_arena_hi(ar->id) + 1;
+        pad = (align - ((size_t)bp & (align-1))) & (align-1);
+        if (pad != 0 && pad < MIN_BLOCK_SIZE)
+            pad += align;
+        if ((bp = extend_heap((pad + asize)/WSIZE)) == NULL)
+            return NULL;
+    }
+    removeBlock(bp);
+    csize = GET_SIZE(HDRP(bp));
+    
+    /* A leading fragment must be large enough to be a free block itself */
+    pad = (align - ((size_t)bp & (align-1))) & (align-1);
+    if (pad != 0 && pad < MIN_BLOCK_SIZE)
+        pad += align;
+    
+    if (pad != 0) {
+        PUT(HDRP(bp), PACK(pad, GET_PREV_ALLOC(HDRP(bp))));
+        PUT(FTRP(bp), PACK(pad, 0));
+        insertBlock(bp);
+        bp += pad;
+        PUT(HDRP(bp), PACK(csize - pad, 1));
+    }
+    else
+        PUT(HDRP(bp), PACK(csize, GET_PREV_ALLOC(HDRP(bp)) | 1));
+    
+    trim_block(bp, asize);
+    return bp;
+}
+
+#if USE_QUICK
+
+/*
+ * Free and coalesce every block waiting on a quick list. Returns 1 if
+ * there were any, i.e. if another find_fit might now succeed.
+ */
+static int quick_consolidate(void) {
+    int i;
+    size_t size;
+    char *bp;
+    
+    if (ar->quick_count == 0)
+        return 0;
+    for (i = 0; i < QUICK_LISTS; i++) {
+        while ((bp = ar->quick_lists[i]) != NULL) {
+            ar->quick_lists[i] = GET_PTR(bp);
+            size = GET_SIZE(HDRP(bp));
+            PUT(HDRP(bp), PACK(size, GET_PREV_ALLOC(HDRP(bp))));
+            PUT(FTRP(bp), PACK(size, 0));
+            coalesce(bp);
+        }
+    }
+    ar->quick_count = 0;
+    ar->ctr.quick_bytes = 0;
+    return 1;
+}
+
+#endif
+
+#if USE_SLAB
+
+/*
+ * Return the slab class of the page holding p, or 0 if p is not a slab
+ * object. Pages past the brk always map to 0, so the bound is the size of
+ * slab_map rather than mem_heap_hi(), which another thread may be moving.
+ */
+static int slab_class(void *p) {
+    if ((char *)p < heap_base || SLAB_INDEX(p) >= SLAB_MAP_SIZE)
+        return 0;
+    return slab_map[SLAB_INDEX(p)];
+}
+
+/* Put a slab page at the front of its class's list of pages with free slots */
+static void slab_link(char *pg, int cls) {
+    char *head = ar->slab_partial[cls];
+    
+    PUT_PTR(SLAB_PREV(pg), NULL);
+    PUT_PTR(SLAB_NEXT(pg), head);
+    if (head != NULL)
+        PUT_PTR(SLAB_PREV(head), pg);
+    ar->slab_partial[cls] = pg;
+}
+
+/* Take a slab page off its class's list of pages with free slots */
+static void slab_unlink(char *pg, int cls) {
+    char *prev = GET_PTR(SLAB_PREV(pg));
+    char *next = GET_PTR(SLAB_NEXT(pg));
+    
+    if (prev == NULL)
+        ar->slab_partial[cls] = next;
+    else
+        PUT_PTR(SLAB_NEXT(prev), next);
+    if (next != NULL)
+        PUT_PTR(SLAB_PREV(next), prev);
+}
+
+/* Allocate a slot of the smallest class that holds size bytes */
+static void *slab_alloc(size_t size) {
+    int cls = SLAB_CLASS(size);
+    size_t objsize = cls * DSIZE;
+    char *pg = ar->slab_partial[cls];
+    char *obj;
+    
+    /* No page of this class has room -> carve a new one out of the heap */
+    if (pg == NULL) {
+        SLAB_HEAP_LOCK();
+        pg = alloc_aligned(adjust_size(SLAB_PAGE), SLAB_PAGE);
+        SLAB_HEAP_UNLOCK();
+        if (pg == NULL)
+            return NULL;
+        PUT_PTR(SLAB_FREE(pg), NULL);
+        PUT(SLAB_USED(pg), 0);
+        PUT(SLAB_BUMP(pg), SLAB_HDR);
+        slab_map[SLAB_INDEX(pg)] = cls;
+        slab_link(pg, cls);
+    }
+    
+    /* Reuse a freed slot if there is one, otherwise bump into fresh space */
+    if ((obj = GET_PTR(SLAB_FREE(pg))) != NULL)
+        PUT_PTR(SLAB_FREE(pg), GET_PTR(obj));
+    else {
+        obj = pg + GET(SLAB_BUMP(pg));
+        PUT(SLAB_BUMP(pg), GET(SLAB_BUMP(pg)) + objsize);
+    }
+    PUT(SLAB_USED(pg), GET(SLAB_USED(pg)) + 1);
+    
+    if (SLAB_FULL(pg, objsize))
+        slab_unlink(pg, cls);
+    return obj;
+}
+
+/*
+ * Return a slot to its page. A page that empties goes back to the heap,
+ * unless it is the only page its class has left.
+ */
+static void slab_free(void *p, int cls) {
+    size_t objsize = cls * DSIZE;
+    char *pg = SLAB_BASE(p);
+    int was_full = SLAB_FULL(pg, objsize);
+    
+    PUT_PTR(p, GET_PTR(SLAB_FREE(pg)));
+    PUT_PTR(SLAB_FREE(pg), p);
+    PUT(SLAB_USED(pg), GET(SLAB_USED(pg)) - 1);
+    
+    if (was_full)
+        slab_link(pg, cls);
+    else if (GET(SLAB_USED(pg)) == 0 &&
+             (ar->slab_partial[cls] != pg || GET_PTR(SLAB_NEXT(pg)) != NULL)) {
+        slab_unlink(pg, cls);
+        slab_map[SLAB_INDEX(pg)] = 0;
+        SLAB_HEAP_LOCK();
+        heap_free(pg);
+        SLAB_HEAP_UNLOCK();
+    }
+}
+
+#endif
+
+/* Put a pool page at the front of one of its pool's lists */
+static void pool_link(pool_page_t **head, pool_page_t *pg) {
+    pg->prev = NULL;
+    pg->next = *head;
+    if (*head != NULL)
+        (*head)->prev = pg;
+    *head = pg;
+}
+
+/* Take a pool page off one of its pool's lists */
+static void pool_unlink(pool_page_t **head, pool_page_t *pg) {
+    if (pg->prev == NULL)
+        *head = pg->next;
+    else
+        pg->prev->next = pg->next;
+    if (pg->next != NULL)
+        pg->next->prev = pg->prev;
+}
+
+#if TCACHE
+
+/* Drop a cache left over from before the last mm_init */
+static void tcache_check(void) {
+    arena_pick();       /* registers the thread, so its cache is flushed at exit */
+    if (tcache.epoch != heap_epoch) {
+        memset(tcache.head, 0, sizeof(tcache.head));
+        memset(tcache.count, 0, sizeof(tcache.count));
+        tcache.epoch = heap_epoch;
+    }
+}
+
+/* Pop a cached object of class cls, refilling from arena a's slabs when empty */
+static void *tcache_alloc(arena_t *a, int cls) {
+    char *obj;
+    int i;
+    
+    tcache_check();
+    if (tcache.head[cls] == NULL) {
+        arena_lock(a);
+        remote_drain(a);
+        if (ar->heap_listp != 0 || heap_init() == 0) {
+            for (i = 0; i < TCACHE_BATCH && (obj = slab_alloc(cls * DSIZE)) != NULL; i++) {
+                PUT_PTR(obj, tcache.head[cls]);
+                tcache.head[cls] = obj;
+                tcache.count[cls]++;
+            }
+        }
+        arena_unlock(a);
+        if (tcache.head[cls] == NULL)
+            return NULL;
+    }
+    
+    obj = tcache.head[cls];
+    tcache.head[cls] = GET_PTR(obj);
+    tcache.count[cls]--;
+    return obj;
+}
+
+/* Push an object onto the cache, spilling a batch to the slabs when full */
+static void tcache_free(void *obj, int cls) {
+    tcache_check();
+    PUT_PTR(obj, tcache.head[cls]);
+    tcache.head[cls] = obj;
+    if (++tcache.count[cls] > TCACHE_COUNT)
+        tcache_spill(cls, TCACHE_BATCH);
+}
+
+/* Give up to n cached objects of class cls back to the arenas that own them,
+   queueing those of other arenas as remote frees */
+static void tcache_spill(int cls, int n) {
+    arena_t *locked = NULL;
+    arena_t *a;
+    char *obj;
+    
+    while (n-- > 0 && (obj = tcache.head[cls]) != NULL) {
+        tcache.head[cls] = GET_PTR(obj);
+        tcache.count[cls]--;
+        if ((a = ARENA_OF(obj)) != my_arena) {
+            remote_push(a, obj);
+            continue;
+        }
+        if (a != locked) {
+            if (locked != NULL)
+                arena_unlock(locked);
+            arena_lock(a);
+            locked = a;
+        }
+        slab_free(obj, cls);
+    }
+    if (locked != NULL)
+        arena_unlock(locked);
+}
+
+/* Give every cached object back (runs at thread exit) */
+static void tcache_flush(void) {
+    int cls;
+    
+    if (tcache.epoch != heap_epoch)
+        return;
+    for (cls = 1; cls <= SLAB_CLASSES; cls++)
+        tcache_spill(cls, tcache.count[cls]);
+}
+
+#endif
+
+/* Adjust a request size to include the header and alignment reqs */
+static size_t adjust_size(size_t size) {
+    /* Make sure allocated block is 16 bytes -- add padding */
+    if (size <= MIN_BLOCK_SIZE - WSIZE)
+        return MIN_BLOCK_SIZE;
+    return BLOCK_ROUND(size + WSIZE);
+}
+
+/*
+ * Shrink allocated block bp to asize bytes, returning the tail to the
+ * free lists (merged with a free block after it) when it is big enough
+ * to stand on its own.
+ */
+static void trim_block(void *bp, size_t asize) {
+    size_t csize = GET_SIZE(HDRP(bp));
+    
+    if ((csize - asize) >= MIN_BLOCK_SIZE) {
+        PUT(HDRP(bp), PACK(asize, (GET(HDRP(bp)) & (PREV_ALLOC | GROWING)) | 1));
+        bp = NEXT_BLKP(bp);
+        PUT(HDRP(bp), PACK(csize - asize, PREV_ALLOC));
+        PUT(FTRP(bp), PACK(csize - asize, 0));
+        coalesce(bp);
+    }
+    else
+        SET_PREV_ALLOC(HDRP(NEXT_BLKP(bp)));
+}
+
+static void *extend_heap(size_t words) {
+    char *bp;
+    size_t size;
+    
+    /* Allocate a whole number of BLOCK_ALIGN units to maintain alignment */
+    size = BLOCK_ROUND(words * WSIZE);
+    if (size < MIN_BLOCK_SIZE)
+        size = MIN_BLOCK_SIZE;
+    
+#if MM_ARENAS > 1
+    /* A full arena fails quietly so arena_malloc can move on to the next
+       one; only running out in the last arena it tries gets reported */
+    if (size > mem_arena_room(ar->id) && !ar_last)
+        return NULL;
+#endif
+    ar->ctr.sbrks++;
+    if ((long)(bp = mem_arena_sbrk(ar->id, size)) == -1)
+        return NULL;
+    
+    /* Initialize free block header/footer and the epilogue header */
+    PUT(HDRP(bp), PACK(size, GET_PREV_ALLOC(HDRP(bp))));    /* Free block header, inherits old epilogue's bit */
+    PUT(FTRP(bp), PACK(size, 0));                           /* Free block footer */
+    PUT(HDRP(NEXT_BLKP(bp)), PACK(0, 1));                   /* New epilogue header */
+    
+    /* Coalesce if the previous block was free */
+    return coalesce(bp);
+}
+
+static void *coalesce(void *bp){
+    size_t prev_alloc = GET_PREV_ALLOC(HDRP(bp));
+    size_t next_alloc = GET_ALLOC(HDRP(NEXT_BLKP(bp)));
+    size_t size = GET_SIZE(HDRP(bp));
+    
+    ar->ctr.coalesces[(!prev_alloc << 1) | !next_alloc]++;
+    
+    /* Previous and next blocks are allocated -> no coalescing necessary */
+    
+    
+    /* Previous block unallocated, next block allocated -> coalesce with previous block */
+    if (!prev_alloc && next_alloc){
+        // Update header of previous block and footer of bp
+        size += GET_SIZE(HDRP(PREV_BLKP(bp)));
+        removeBlock(PREV_BLKP(bp));                             /* Remove the previous block from its free list */
+        PUT(HDRP(PREV_BLKP(bp)), PACK(size, PREV_ALLOC));       /* Update header of previous block */
+        PUT(FTRP(bp), PACK(size, 0));                           /* Update footer of current block */
+        bp = PREV_BLKP(bp);                                     /* Set bp to point to start of previous block */
+    }
+    
+    /* Next block unallocated, prev block allocated -> coalesce with next block */
+    else if (!next_alloc && prev_alloc){
+        // Update header of current block and footer of next block
+        size += GET_SIZE(HDRP(NEXT_BLKP(bp)));
+        removeBlock(NEXT_BLKP(bp));                  /* Remove next block from its free list */
+        PUT(HDRP(bp), PACK(size, PREV_ALLOC));
+        PUT(FTRP(bp), PACK(size, 0));                /* FTRP now follows the new size in the header */
+    }
+    
+    /* Both the prev and next blocks are unallocated -> coalesce in both directions*/
+    else if (!prev_alloc && !next_alloc) {
+        size += GET_SIZE(HDRP(PREV_BLKP(bp))) + GET_SIZE(FTRP(NEXT_BLKP(bp)));
+        removeBlock(PREV_BLKP(bp));                             /* Remove the previous block from its free list */
+        removeBlock(NEXT_BLKP(bp));                             /* Remove next block from its free list */
+        PUT(HDRP(PREV_BLKP(bp)), PACK(size, PREV_ALLOC));       /* Update header of previous block */
+        PUT(FTRP(NEXT_BLKP(bp)), PACK(size, 0));                /* Update footer of next block */
+        bp = PREV_BLKP(bp);
+    }
+    
+    /* The block after the coalesced one now follows a free block */
+    CLR_PREV_ALLOC(HDRP(NEXT_BLKP(bp)));
+    CHK_ABSORB(bp, size);
+    insertBlock(bp);
+
+    return bp;
+}
+
+/* Length of the mapping that holds a size-byte payload off bytes in,
+   or 0 if that does not fit in a size_t */
+static size_t mapped_size(size_t size, size_t off) {
+    size_t pagesize = mem_pagesize();
+    
+    if (size > (size_t)-1 - off - (pagesize - 1))
+        return 0;
+    return (size + off + pagesize - 1) & ~(pagesize - 1);
+}
+
+/*
+ * Give a huge request its own mapping, with the payload aligned to align,
+ * at most a page; returns NULL if memlib refuses.
+ */
+static void *mapped_alloc(size_t size, size_t align) {
+    size_t off = MAX(align, MAPPED_PAD);
+    size_t len = mapped_size(size, off);
+    char *bp;
+    
+    if (len == 0 || (bp = mem_map(len)) == (void *)-1)
+        return NULL;
+    bp += off;
+    MAPPED_LEN(bp) = len;
+    PUT(HDRP(bp), PACK(off, 1));
+    return bp;
+}
+
+/* Resize a mapped block with mem_remap, which may move it without copying */
+static void *mapped_resize(void *bp, size_t size) {
+    size_t off = MAPPED_OFF(bp);
+    size_t len = mapped_size(size, off);
+    char *base;
+    
+    if (len == 0)
+        return NULL;
+    if (len == MAPPED_LEN(bp))
+        return bp;
+    if ((base = mem_remap(MAPPED_BASE(bp), len)) == (void *)-1)
+        return NULL;
+    bp = base + off;
+    MAPPED_LEN(bp) = len;
+    return bp;
+}
+
+/*
+ * heap_trim - If the free block bp sits at the top of the heap and is at
+ *     least TRIM_THRESHOLD bytes, shrink the brk so only TRIM_KEEP bytes
+ *     of it remain.
+ */
+static void heap_trim(void *bp) {
+    size_t size = GET_SIZE(HDRP(bp));
+    size_t release;
+
+    if (size < TRIM_THRESHOLD || GET_SIZE(HDRP(NEXT_BLKP(bp))) != 0)
+        return;
+
+    release = size - TRIM_KEEP;
+    removeBlock(bp);
+    ar->ctr.sbrks++;
+    if (mem_arena_sbrk(ar->id, -(int)release) == (void *)-1) {
+        insertBlock(bp);
+        return;
+    }
+
+    PUT(HDRP(bp), PACK(TRIM_KEEP, GET_PREV_ALLOC(HDRP(bp))));
+    PUT(FTRP(bp), PACK(TRIM_KEEP, 0));
+    PUT(HDRP(NEXT_BLKP(bp)), PACK(0, 1));                   /* New epilogue header */
+    CHK_ABSORB(bp, size + 1);                               /* the old epilogue is gone too */
+    insertBlock(bp);
+}
+
+#if FIT_POLICY == FIT_TLSF
+
+/* Map a block size onto its TLSF first- and second-level indices */
+static void tlsf_mapping(size_t size, int *fl, int *sl) {
+    int f;
+    
+    if (size < (1 << FL_SHIFT)) {
+        *fl = 0;
+        *sl = size >> 3;
+        return;
+    }
+    f = 31 - __builtin_clz((unsigned int)size);
+    *fl = f - FL_SHIFT + 1;
+    *sl = (size >> (f - SL_LOG2)) ^ SL_COUNT;
+}
+
+/* Return the address of the free-list head that holds blocks of this size */
+static char **list_head(size_t size) {
+    int fl, sl;
+    
+    tlsf_mapping(size, &fl, &sl);
+    return &ar->tlsf_lists[fl][sl];
+}
+
+/*
+ * Find a free block of at least asize bytes in constant time. The head of
+ * the request's own list is tried first; otherwise asize is rounded up
+ * to the next list boundary so that any block found through the bitmaps
+ * is guaranteed to fit, whatever the state of the heap.
+ */
+static void *find_fit(size_t asize) {
+    char *curr = *list_head(asize);
+    unsigned int map;
+    int fl, sl;
+    
+    ar->ctr.fit_searches++;
+    ar->ctr.fit_probes += (curr != NULL);
+    if (curr != NULL && GET_SIZE(HDRP(curr)) >= asize)
+        return curr;
+    
+    if (asize >= (1 << FL_SHIFT))
+        asize += (1 << (31 - __builtin_clz((unsigned int)asize) - SL_LOG2)) - 1;
+    tlsf_mapping(asize, &fl, &sl);
+    if (fl >= FL_COUNT)
+        return NULL;
+    
+    /* Smallest non-empty list at this first level that is big enough */
+    map = ar->sl_bitmap[fl] & (~0U << sl);
+    if (map == 0) {
+        /* Otherwise the smallest non-empty list of any larger first level */
+        map = ar->fl_bitmap & (~0U << (fl + 1));
+        if (map == 0)
+            return NULL;
+        fl = __builtin_ctz(map);
+        map = ar->sl_bitmap[fl];
+    }
+    sl = __builtin_ctz(map);
+    ar->ctr.fit_probes++;
+    return ar->tlsf_lists[fl][sl];
+}
+
+/* The largest free block is on the highest non-empty list */
+static size_t largest_free(void) {
+    size_t max = 0;
+    char *bp;
+    int fl, sl;
+    
+    if (ar->fl_bitmap == 0)
+        return 0;
+    fl = 31 - __builtin_clz(ar->fl_bitmap);
+    sl = 31 - __builtin_clz(ar->sl_bitmap[fl]);
+    for (bp = ar->tlsf_lists[fl][sl]; bp != NULL; bp = GET_NEXT_FREE(bp))
+        max = MAX(max, GET_SIZE(HDRP(bp)));
+    return max;
+}
+
+#elif FIT_POLICY == FIT_ADDRORDER
+
+/* The head of the skip list is represented by a NULL node */
+static char *skip_next(char *n, int i) {
+    return n == NULL ? ar->skip_head_next[i] : GET_PTR(SKIP_NEXTP(n, i));
+}
+
+static void skip_set_next(char *n, int i, char *val) {
+    if (n == NULL)
+        ar->skip_head_next[i] = val;
+    else
+        PUT_PTR(SKIP_NEXTP(n, i), val);
+}
+
+/* Largest block in (n, next at level i]; a level-0 span is just the next block */
+static size_t skip_span(char *n, int i) {
+    char *next;
     
-    PUT(heap_listp + (2*WSIZE), 0);
-    PUT(heap_listp + (3*WSIZE), 0);
+    if (i == 0) {
+        next = skip_next(n, 0);
+        return next == NULL ? 0 : GET_SIZE(HDRP(next));
+    }
+    return n == NULL ? ar->skip_head_span[i] : GET(SKIP_SPANP(n, i));
+}
+
+static void skip_set_span(char *n, int i, size_t val) {
+    if (n == NULL)
+        ar->skip_head_span[i] = val;
+    else
+        PUT(SKIP_SPANP(n, i), val);
+}
+
+/* Recompute the span of n's level-i link from the level below it */
+static void skip_fix_span(char *n, int i) {
+    char *end = skip_next(n, i);
+    char *x;
+    size_t max = 0;
     
+    if (end != NULL)
+        for (x = n; x != end; x = skip_next(x, i-1))
+            max = MAX(max, skip_span(x, i-1));
+    skip_set_span(n, i, max);
+}
+
+/* Fill update[] with the last node before bp at every level in use */
+static void skip_find(char *bp, char **update) {
+    char *curr = NULL;
+    char *next;
+    int i;
     
-    PUT(heap_listp + (4*WSIZE), PACK(MIN_BLOCK_SIZE, 1));              /* Prologue footer */
-    PUT(heap_listp + MIN_BLOCK_SIZE + WSIZE, PACK(0, 1));                                /* Epilogue header */
+    for (i = ar->skip_top - 1; i >= 0; i--) {
+        while ((next = skip_next(curr, i)) != NULL && next < bp)
+            curr = next;
+        update[i] = curr;
+    }
+}
 
-    free_listp = heap_listp + DSIZE;
+/* Link a free block into the skip list at its address */
+static void skip_insert(char *bp) {
+    char *update[SKIP_LEVELS];
+    size_t size = GET_SIZE(HDRP(bp));
+    int cap = ((size - DSIZE) / WSIZE + 1) / 2;      /* tallest node that fits */
+    int height = 1;
+    int i;
     
-    /* Extend the empty heap with a free block of CHUNKSIZE bytes */
-    if (extend_heap(CHUNKSIZE/WSIZE) == NULL)
-        return -1;
+    ar->skip_seed ^= ar->skip_seed << 13;
+    ar->skip_seed ^= ar->skip_seed >> 17;
+    ar->skip_seed ^= ar->skip_seed << 5;
+    while (height < SKIP_LEVELS && height < cap && (ar->skip_seed >> (2*height) & 3) == 0)
+        height++;
     
-    /* Assign head to initialized free block */
+    for (i = ar->skip_top; i < height; i++) {
+        skip_set_next(NULL, i, NULL);
+        skip_set_span(NULL, i, 0);
+    }
+    ar->skip_top = MAX(ar->skip_top, height);
+    skip_find(bp, update);
     
+    for (i = 0; i < height; i++) {
+        skip_set_next(bp, i, skip_next(update[i], i));
+        skip_set_next(update[i], i, bp);
+    }
     
-    return 0;
+    /* Split spans where bp was linked in, widen the ones that jump over it */
+    for (i = 1; i < ar->skip_top; i++) {
+        if (i < height) {
+            skip_fix_span(bp, i);
+            skip_fix_span(update[i], i);
+        }
+        else if (skip_next(update[i], i) != NULL && skip_span(update[i], i) < size)
+            skip_set_span(update[i], i, size);
+    }
 }
 
-/*
- * mm_malloc - Allocate a block by incrementing the brk pointer.
- *     Always allocate a block whose size is a multiple of the alignment.
- */
-void *mm_malloc(size_t size)
-{
-    size_t asize;        /* Adjusted block size */
-    size_t extendsize;   /* Amount to extend heap if no fit */
-    char *bp;
-    
-    // Ignore spurious requests
-    if (size == 0)
-        return NULL;
+/* Unlink a free block from the skip list */
+static void skip_remove(char *bp) {
+    char *update[SKIP_LEVELS];
+    int i;
     
-    /* Adjust block size to include overhead and alignment reqs */
-    /* Make sure allocated block is 16 bytes -- add padding */
-    if (size <= 2*DSIZE)
-        asize = MIN_BLOCK_SIZE;
-    else
-        asize = DSIZE * ((size + (DSIZE) + (DSIZE-1)) / DSIZE);
+    skip_find(bp, update);
+    for (i = 0; i < ar->skip_top && skip_next(update[i], i) == bp; i++)
+        skip_set_next(update[i], i, skip_next(bp, i));
     
-    /* Search the free list for a fit */
-    if ((bp = find_fit(asize)) != NULL){
-        place(bp, asize);
-        return bp;
-    }
+    /* Every span that covered bp is recomputed, merged ones included */
+    for (i = 1; i < ar->skip_top; i++)
+        skip_fix_span(update[i], i);
     
-    /* No fit found. Get more memory and place block */
-    extendsize = MAX(asize, CHUNKSIZE);
-    if ((bp = extend_heap(extendsize/WSIZE)) == NULL)
-        return NULL;
-    place(bp, asize);
-    return bp;
+    while (ar->skip_top > 1 && ar->skip_head_next[ar->skip_top - 1] == NULL)
+        ar->skip_top--;
 }
 
 /*
- * mm_free - Freeing a block does nothing.
+ * Address-ordered first fit: descend from the top level, jumping over any
+ * span whose largest block is too small. The block after where the
+ * descent ends is the lowest-addressed block that fits.
  */
-void mm_free(void *bp)
-{
-    size_t size = GET_SIZE(HDRP(bp));
-    if (heap_listp == 0)
-        mm_init();
+static void *find_fit(size_t asize) {
+    char *curr = NULL;
+    int i;
     
-    PUT(HDRP(bp), PACK(size, 0));
-    PUT(FTRP(bp), PACK(size, 0));
+    ar->ctr.fit_searches++;
+    for (i = ar->skip_top - 1; i >= 0; i--) {
+        while (skip_next(curr, i) != NULL && skip_span(curr, i) < asize) {
+            curr = skip_next(curr, i);
+            ar->ctr.fit_probes++;
+        }
+    }
+    return skip_next(curr, 0);
+}
+
+/* Take the largest span at every level on the way down the list */
+static size_t largest_free(void) {
+    char *curr = NULL;
+    size_t max = 0;
+    int i;
     
-    /* This immediately coalesces when a block is freed */
-    coalesce(bp);
+    for (i = ar->skip_top - 1; i >= 0; i--) {
+        while (skip_next(curr, i) != NULL) {
+            max = MAX(max, skip_span(curr, i));
+            curr = skip_next(curr, i);
+        }
+    }
+    return max;
+}
+
+#else
+
+/* Map a block size onto the index of its segregated free list */
+static int size_class(size_t size) {
+    int k = (31 - __builtin_clz((unsigned int)size)) - MIN_CLASS_SHIFT;
+    
+    if (k < 0)
+        return 0;
+    if (k >= NUM_CLASSES)
+        return NUM_CLASSES - 1;
+    return k;
+}
+
+/* Return the address of the free-list head that holds blocks of this size */
+static char **list_head(size_t size) {
+    return &ar->seg_lists[size_class(size)];
 }
 
 /*
- * mm_realloc - Implemented simply in terms of mm_malloc and mm_free
+ * Find a free block of at least asize bytes. The request's own class is
+ * searched first-fit; failing that, the head of the next non-empty class
+ * is guaranteed to be large enough, so no further scanning is needed.
+ * Large requests, and small ones no list can satisfy, take the best fit
+ * from the tree.
  */
-void *mm_realloc(void *ptr, size_t size)
-{
-    void *oldptr = ptr;
-    void *newptr;
-    size_t copySize;
+static void *find_fit(size_t asize) {
+    int k;
+    char *curr;
     
-    newptr = mm_malloc(size);
-    if (newptr == NULL)
-      return NULL;
-    copySize = GET_SIZE(HDRP(oldptr));
-    if (size < copySize)
-      copySize = size;
-    memcpy(newptr, oldptr, copySize);
-    mm_free(oldptr);
-    return newptr;
+    ar->ctr.fit_searches++;
+    if (asize < TREE_MIN_SIZE) {
+        k = size_class(asize);
+        for (curr = ar->seg_lists[k]; curr != NULL; curr = GET_NEXT_FREE(curr)){
+            ar->ctr.fit_probes++;
+            if (GET_SIZE(HDRP(curr)) >= asize){
+                return curr;
+            }
+        }
+        
+        for (k++; k < NUM_CLASSES; k++){
+            if (ar->seg_lists[k] != NULL)
+                return ar->seg_lists[k];
+        }
+    }
+    return tree_best_fit(asize);
 }
 
-static void *extend_heap(size_t words) {
-    char *bp;
-    size_t size;
+/* Orders tree nodes by block size, breaking ties by address */
+static int tree_less(char *a, char *b) {
+    size_t asize = GET_SIZE(HDRP(a));
+    size_t bsize = GET_SIZE(HDRP(b));
     
-    /* Allocate an even number of words to maintain alignment */
-    size = (words % 2) ? (words+1) * WSIZE : words * WSIZE;
-    if (size < MIN_BLOCK_SIZE)
-        size = MIN_BLOCK_SIZE;
-    
-    if ((long)(bp = mem_sbrk(size)) == -1)
-        return NULL;
-    
-    /* Initialize free block header/footer and the epilogue header */
-    PUT(HDRP(bp), PACK(size, 0));           /* Free block header */
-    PUT(FTRP(bp), PACK(size, 0));           /* Free block footer */
-    PUT(HDRP(NEXT_BLKP(bp)), PACK(0, 1));   /* New epilogue header */
-    
-    /* Coalesce if the previous block was free */
-    return coalesce(bp);
+    return asize < bsize || (asize == bsize && a < b);
 }
 
-static void *coalesce(void *bp){
-    size_t prev_alloc = GET_ALLOC(FTRP(PREV_BLKP(bp)));
-    size_t next_alloc = GET_ALLOC(HDRP(NEXT_BLKP(bp)));
-    size_t size = GET_SIZE(HDRP(bp));
-    
-    if (PREV_BLKP(bp) == bp)
-        prev_alloc = 1;
+/* Point whatever referenced old (its parent, or the root) at new instead */
+static void tree_replace_child(char *parent, char *old, char *new) {
+    if (parent == NULL)
+        ar->tree_root = new;
+    else if (GET_LEFT(parent) == old)
+        PACK_LEFT(parent, new);
+    else
+        PACK_RIGHT(parent, new);
+}
+
+static void tree_rotate_left(char *x) {
+    char *y = GET_RIGHT(x);
     
-    /* Previous and next blocks are allocated -> no coalescing necessary */
+    PACK_RIGHT(x, GET_LEFT(y));
+    if (GET_LEFT(y) != NULL)
+        PACK_PARENT(GET_LEFT(y), x);
+    PACK_PARENT(y, GET_PARENT(x));
+    tree_replace_child(GET_PARENT(x), x, y);
+    PACK_LEFT(y, x);
+    PACK_PARENT(x, y);
+}
+
+static void tree_rotate_right(char *x) {
+    char *y = GET_LEFT(x);
     
+    PACK_LEFT(x, GET_RIGHT(y));
+    if (GET_RIGHT(y) != NULL)
+        PACK_PARENT(GET_RIGHT(y), x);
+    PACK_PARENT(y, GET_PARENT(x));
+    tree_replace_child(GET_PARENT(x), x, y);
+    PACK_RIGHT(y, x);
+    PACK_PARENT(x, y);
+}
+
+/* Insert a free block into the tree and restore the red-black invariants */
+static void tree_insert(char *bp) {
+    char *parent = NULL;
+    char *curr = ar->tree_root;
+    char *gp, *uncle;
     
-    /* Previous block unallocated, next block allocated -> coalesce with previous block */
-    if (!prev_alloc && next_alloc){
-        // Update header of previous block and footer of bp
-        size += GET_SIZE(HDRP(PREV_BLKP(bp)));                  /* Why not FTRP? */
-        removeBlock(PREV_BLKP(bp));                             /* Remove the previous block from free list */
-        PUT(HDRP(PREV_BLKP(bp)), PACK(size, 0));                /* Update header of previous block */
-        PUT(FTRP(bp), PACK(size, 0));                           /* Update footer of current block */
-        bp = PREV_BLKP(bp);                                     /* Set bp to point to start of previous block */
-        
-        
+    while (curr != NULL) {
+        parent = curr;
+        curr = tree_less(bp, curr) ? GET_LEFT(curr) : GET_RIGHT(curr);
     }
+    PACK_LEFT(bp, NULL);
+    PACK_RIGHT(bp, NULL);
+    PACK_PARENT(bp, parent);
+    PUT(TREE_COLOR(bp), RED);
+    if (parent == NULL)
+        ar->tree_root = bp;
+    else if (tree_less(bp, parent))
+        PACK_LEFT(parent, bp);
+    else
+        PACK_RIGHT(parent, bp);
     
-    /* Next block unallocated, prev block allocated -> coalesce with next block */
-    else if (!next_alloc && prev_alloc){
-        // Update header of current block and footer of next block
-        size += GET_SIZE(HDRP(NEXT_BLKP(bp)));
-        removeBlock(NEXT_BLKP(bp));                  /* Remove next block from free list */
-        PUT(HDRP(bp), PACK(size, 0));
-        PUT(FTRP(bp), PACK(size, 0));                /* Different from book code -- why? */
-        
+    /* Walk up while bp and its parent are both red */
+    while ((parent = GET_PARENT(bp)) != NULL && IS_RED(parent)) {
+        gp = GET_PARENT(parent);
+        if (parent == GET_LEFT(gp)) {
+            uncle = GET_RIGHT(gp);
+            if (IS_RED(uncle)) {
+                PUT(TREE_COLOR(parent), BLACK);
+                PUT(TREE_COLOR(uncle), BLACK);
+                PUT(TREE_COLOR(gp), RED);
+                bp = gp;
+                continue;
+            }
+            if (bp == GET_RIGHT(parent)) {
+                tree_rotate_left(parent);
+                bp = parent;
+                parent = GET_PARENT(bp);
+            }
+            PUT(TREE_COLOR(parent), BLACK);
+            PUT(TREE_COLOR(gp), RED);
+            tree_rotate_right(gp);
+        }
+        else {
+            uncle = GET_LEFT(gp);
+            if (IS_RED(uncle)) {
+                PUT(TREE_COLOR(parent), BLACK);
+                PUT(TREE_COLOR(uncle), BLACK);
+                PUT(TREE_COLOR(gp), RED);
+                bp = gp;
+                continue;
+            }
+            if (bp == GET_LEFT(parent)) {
+                tree_rotate_right(parent);
+                bp = parent;
+                parent = GET_PARENT(bp);
+            }
+            PUT(TREE_COLOR(parent), BLACK);
+            PUT(TREE_COLOR(gp), RED);
+            tree_rotate_left(gp);
+        }
     }
+    PUT(TREE_COLOR(ar->tree_root), BLACK);
+}
+
+/* Unlink a free block from the tree and restore the red-black invariants */
+static void tree_remove(char *bp) {
+    char *x, *xparent, *y, *w;
+    int removed_color = GET(TREE_COLOR(bp));
     
-    /* Both the prev and next blocks are unallocated -> coalesce in both directions*/
-    else if (!prev_alloc && !next_alloc) {
-        size += GET_SIZE(HDRP(PREV_BLKP(bp))) + GET_SIZE(FTRP(NEXT_BLKP(bp)));
-        removeBlock(PREV_BLKP(bp));                             /* Remove the previous block from free list */
-        removeBlock(NEXT_BLKP(bp));                             /* Remove next block from free list */
-        PUT(HDRP(PREV_BLKP(bp)), PACK(size, 0));                /* Update header of previous block */
-        PUT(FTRP(NEXT_BLKP(bp)), PACK(size, 0));                /* Update footer of next block */
-        bp = PREV_BLKP(bp);
-        
+    if (GET_LEFT(bp) == NULL || GET_RIGHT(bp) == NULL) {
+        /* At most one child: splice bp out directly */
+        x = GET_LEFT(bp) != NULL ? GET_LEFT(bp) : GET_RIGHT(bp);
+        xparent = GET_PARENT(bp);
+        tree_replace_child(xparent, bp, x);
+        if (x != NULL)
+            PACK_PARENT(x, xparent);
+    }
+    else {
+        /* Two children: bp's in-order successor y takes its place */
+        for (y = GET_RIGHT(bp); GET_LEFT(y) != NULL; y = GET_LEFT(y))
+            ;
+        removed_color = GET(TREE_COLOR(y));
+        x = GET_RIGHT(y);
+        if (GET_PARENT(y) == bp)
+            xparent = y;
+        else {
+            xparent = GET_PARENT(y);
+            PACK_LEFT(xparent, x);
+            if (x != NULL)
+                PACK_PARENT(x, xparent);
+            PACK_RIGHT(y, GET_RIGHT(bp));
+            PACK_PARENT(GET_RIGHT(y), y);
+        }
+        tree_replace_child(GET_PARENT(bp), bp, y);
+        PACK_PARENT(y, GET_PARENT(bp));
+        PACK_LEFT(y, GET_LEFT(bp));
+        PACK_PARENT(GET_LEFT(y), y);
+        PUT(TREE_COLOR(y), GET(TREE_COLOR(bp)));
     }
     
-    insertBlock(bp);
+    if (removed_color == RED)
+        return;
     
-    return bp;
+    /* A black node was removed, so x carries an extra black to push up */
+    while (x != ar->tree_root && !IS_RED(x)) {
+        if (x == GET_LEFT(xparent)) {
+            w = GET_RIGHT(xparent);
+            if (IS_RED(w)) {
+                PUT(TREE_COLOR(w), BLACK);
+                PUT(TREE_COLOR(xparent), RED);
+                tree_rotate_left(xparent);
+                w = GET_RIGHT(xparent);
+            }
+            if (!IS_RED(GET_LEFT(w)) && !IS_RED(GET_RIGHT(w))) {
+                PUT(TREE_COLOR(w), RED);
+                x = xparent;
+                xparent = GET_PARENT(x);
+            }
+            else {
+                if (!IS_RED(GET_RIGHT(w))) {
+                    PUT(TREE_COLOR(GET_LEFT(w)), BLACK);
+                    PUT(TREE_COLOR(w), RED);
+                    tree_rotate_right(w);
+                    w = GET_RIGHT(xparent);
+                }
+                PUT(TREE_COLOR(w), GET(TREE_COLOR(xparent)));
+                PUT(TREE_COLOR(xparent), BLACK);
+                PUT(TREE_COLOR(GET_RIGHT(w)), BLACK);
+                tree_rotate_left(xparent);
+                x = ar->tree_root;
+            }
+        }
+        else {
+            w = GET_LEFT(xparent);
+            if (IS_RED(w)) {
+                PUT(TREE_COLOR(w), BLACK);
+                PUT(TREE_COLOR(xparent), RED);
+                tree_rotate_right(xparent);
+                w = GET_LEFT(xparent);
+            }
+            if (!IS_RED(GET_LEFT(w)) && !IS_RED(GET_RIGHT(w))) {
+                PUT(TREE_COLOR(w), RED);
+                x = xparent;
+                xparent = GET_PARENT(x);
+            }
+            else {
+                if (!IS_RED(GET_LEFT(w))) {
+                    PUT(TREE_COLOR(GET_RIGHT(w)), BLACK);
+                    PUT(TREE_COLOR(w), RED);
+                    tree_rotate_left(w);
+                    w = GET_LEFT(xparent);
+                }
+                PUT(TREE_COLOR(w), GET(TREE_COLOR(xparent)));
+                PUT(TREE_COLOR(xparent), BLACK);
+                PUT(TREE_COLOR(GET_LEFT(w)), BLACK);
+                tree_rotate_right(xparent);
+                x = ar->tree_root;
+            }
+        }
+    }
+    if (x != NULL)
+        PUT(TREE_COLOR(x), BLACK);
 }
 
-/* Helper function to find a free block in the heap
-   Uses the first-fit method
-*/
-
-//static void *find_fit(size_t asize){
-//    void *bp;
-//
-//    for (bp = heap_listp; GET_SIZE(HDRP(bp)) > 0; bp = NEXT_BLKP(bp)){
-//        if (!GET_ALLOC(HDRP(bp)) && (asize <= GET_SIZE(HDRP(bp)))) {
-//            return bp;
-//        }
-//    }
-//    return NULL;
-//}
-
-/* Find first free block that fits in the explicit free list --> linked list traversal */
-static void *find_fit(size_t asize) {
-    void *curr = free_listp;
-    while (curr != NULL){
-        if (GET_SIZE(HDRP(curr)) >= asize){
-            return curr;
+/* Return the smallest free block in the tree of at least asize bytes */
+static void *tree_best_fit(size_t asize) {
+    char *curr = ar->tree_root;
+    char *best = NULL;
+    
+    while (curr != NULL) {
+        ar->ctr.fit_probes++;
+        if (GET_SIZE(HDRP(curr)) >= asize) {
+            best = curr;
+            curr = GET_LEFT(curr);
         }
-        curr = GET_NEXT_FREE(curr);
+        else
+            curr = GET_RIGHT(curr);
     }
-    return NULL;
+    return best;
+}
+
+/* The largest free block is the tree's rightmost node, or on the highest non-empty list */
+static size_t largest_free(void) {
+    char *curr = ar->tree_root;
+    size_t max = 0;
+    int k;
+    
+    if (curr != NULL) {
+        while (GET_RIGHT(curr) != NULL)
+            curr = GET_RIGHT(curr);
+        return GET_SIZE(HDRP(curr));
+    }
+    for (k = NUM_CLASSES - 1; k >= 0 && ar->seg_lists[k] == NULL; k--)
+        ;
+    if (k >= 0)
+        for (curr = ar->seg_lists[k]; curr != NULL; curr = GET_NEXT_FREE(curr))
+            max = MAX(max, GET_SIZE(HDRP(curr)));
+    return max;
 }
 
+#endif
+
 /* Helper function that deals with free block splitting protocol */
-//void place(void *bp, size_t asize){
-//
-//    size_t csize = GET_SIZE(HDRP(bp));
-//
-//    if ((csize - asize) >= (2*ALIGNMENT)){
-//        PUT(HDRP(bp), PACK(asize, 1));
-//        PUT(FTRP(bp), PACK(asize, 1));
-//        bp = NEXT_BLKP(bp);
-//        PUT(HDRP(bp), PACK(csize - asize, 0));
-//        PUT(FTRP(bp), PACK(csize - asize, 0));
-//    }
-//    else {
-//        PUT(HDRP(bp), PACK(csize, 1));
-//        PUT(FTRP(bp), PACK(csize, 1));
-//    }
-//}
-
-void place(void *bp, size_t asize) {
+static void place(void *bp, size_t asize) {
     
     size_t csize = GET_SIZE(HDRP(bp));
+    size_t prev_alloc = GET_PREV_ALLOC(HDRP(bp));
     
-    /* Remove free block from list */
-    //removeBlock(bp);
+    /* Remove free block from its list */
+    removeBlock(bp);
     
-    /* If new free block will be greater than 24 bytes */
+    /* If the remainder is big enough to be a free block on its own */
     if ((csize - asize) >= (MIN_BLOCK_SIZE)){
-        PUT(HDRP(bp), PACK(asize, 1));
-        PUT(FTRP(bp), PACK(asize, 1));
-        removeBlock(bp);
+        PUT(HDRP(bp), PACK(asize, prev_alloc | 1));
         bp = NEXT_BLKP(bp);
-        PUT(HDRP(bp), PACK(csize - asize, 0));
+        PUT(HDRP(bp), PACK(csize - asize, PREV_ALLOC));
         PUT(FTRP(bp), PACK(csize - asize, 0));
-        //insertBlock(bp);
-        coalesce(bp);
+        
+        /* Both neighbours of the remainder are allocated, so no coalescing */
+        insertBlock(bp);
     }
     else {
-        PUT(HDRP(bp), PACK(csize, 1));
-        PUT(FTRP(bp), PACK(csize, 1));
-        removeBlock(bp);
+        PUT(HDRP(bp), PACK(csize, prev_alloc | 1));
+        SET_PREV_ALLOC(HDRP(NEXT_BLKP(bp)));
+    }
+}
+
+/*
+ * Carve n blocks of asize bytes back to back from the front of free
+ * block bp, which holds at least n * asize bytes, storing them in out.
+ * The last block gets the rest of bp and is trimmed like a shrinking
+ * realloc, so whatever is left over goes back to the free lists.
+ */
+static void place_run(void *bp, size_t asize, size_t n, void **out) {
+    size_t csize = GET_SIZE(HDRP(bp));
+    size_t prev_alloc = GET_PREV_ALLOC(HDRP(bp));
+    size_t i;
+    
+    removeBlock(bp);
+    for (i = 0; i < n - 1; i++) {
+        PUT(HDRP(bp), PACK(asize, prev_alloc | 1));
+        out[i] = bp;
+        bp = (char *)bp + asize;
+        csize -= asize;
+        prev_alloc = PREV_ALLOC;
     }
+    PUT(HDRP(bp), PACK(csize, prev_alloc | 1));
+    trim_block(bp, asize);
+    out[n - 1] = bp;
 }
 
-/* Add a block to the front of the free list */
+/* Add a free block to the tree, or to the front of the list for its size class */
 static void insertBlock(void *bp){
+    size_t size = GET_SIZE(HDRP(bp));
+    
+    ar->ctr.free_bytes += size;
+    ar->ctr.free_count[STATS_CLASS(size)]++;
+    ar->chk.changes++;
+#if FIT_POLICY == FIT_ADDRORDER
+    skip_insert(bp);
+#else
+    char **headp;
+    char *head;
     
-    /* If explicit list is empty */
-    if (free_listp == NULL){
-        PACK_PREV(bp, NULL);
-        PACK_NEXT(bp, NULL);
-        free_listp = bp;
+#if FIT_POLICY == FIT_SEGLIST
+    if (size >= TREE_MIN_SIZE) {
+        tree_insert(bp);
+        return;
     }
+#endif
+    headp = list_head(size);
+    head = *headp;
+    
+    PACK_PREV(bp, NULL);
+    PACK_NEXT(bp, head);
     
-    /* If explicit list has 1 or more free blocks */
+    /* If the list already has 1 or more free blocks */
+    if (head != NULL)
+        PACK_PREV(head, bp);
+#if FIT_POLICY == FIT_TLSF
     else {
-        PACK_PREV(bp, NULL);
-        PACK_NEXT(bp, free_listp);
+        /* The list just became non-empty, so flag it in both bitmaps */
+        int fl, sl;
         
-        PACK_PREV(free_listp, bp);
-        free_listp = bp;
+        tlsf_mapping(size, &fl, &sl);
+        ar->sl_bitmap[fl] |= 1U << sl;
+        ar->fl_bitmap |= 1U << fl;
     }
+#endif
     
+    *headp = bp;
+#endif
 }
 
-/* Removes a block from the free list */
+/* Removes a block from the tree or from the free list for its size class */
 static void removeBlock(void *bp){
-    checkBlockOutOfBounds(bp);
-    if (free_listp == 0)
-        return;
-    
-    /* If bp is the first and only block in the free list */
-    if (GET_PREV_FREE(bp) == NULL && !GET_NEXT_FREE(bp) == NULL){
-        free_listp = 0;
-    }
+    size_t size = GET_SIZE(HDRP(bp));
     
-    /* If bp is the first but not only block in the free list*/
-    else if (GET_PREV_FREE(bp) == NULL && GET_NEXT_FREE(bp) != NULL) {
-        /* Set prev of next free block to 0 and update free list head */
-        PACK_PREV(bp, NULL);
-        free_listp = GET_NEXT_FREE(bp);
-    }
+    ar->ctr.free_bytes -= size;
+    ar->ctr.free_count[STATS_CLASS(size)]--;
+    ar->chk.changes++;
+    if (bp == ar->chk.node)
+        ar->chk.node = check_next(bp, ar->chk.list);
+#if FIT_POLICY == FIT_ADDRORDER
+    skip_remove(bp);
+#else
+    char *prev = GET_PREV_FREE(bp);
+    char *next = GET_NEXT_FREE(bp);
     
-    /* If bp is at the end of the list */
-    else if (GET_PREV_FREE(bp) != NULL && GET_NEXT_FREE(bp) == NULL) {
-        /* Set next of prev block to 0 */
-        PACK_NEXT(GET_PREV_FREE(bp), NULL);
+#if FIT_POLICY == FIT_SEGLIST
+    if (size >= TREE_MIN_SIZE) {
+        tree_remove(bp);
+        return;
     }
+#endif
     
-    /* If bp is somewhere in the middle of the list */
-    else if (GET_PREV_FREE(bp) != NULL && GET_NEXT_FREE(bp) != NULL){
-        /* Set next of prev block to next block */
-        GET_PREV_FREE(GET_NEXT_FREE(bp)) = GET_PREV_FREE(bp);
-        
-        /* Set prev of next block to prev block*/
-        GET_NEXT_FREE(GET_PREV_FREE(bp)) = GET_NEXT_FREE(bp);
-
+    /* If bp is the head of its list, the next block becomes the head */
+    if (prev == NULL) {
+        *list_head(size) = next;
+#if FIT_POLICY == FIT_TLSF
+        if (next == NULL) {
+            /* The list just became empty, so clear it from the bitmaps */
+            int fl, sl;
+            
+            tlsf_mapping(size, &fl, &sl);
+            ar->sl_bitmap[fl] &= ~(1U << sl);
+            if (ar->sl_bitmap[fl] == 0)
+                ar->fl_bitmap &= ~(1U << fl);
+        }
+#endif
     }
+    else
+        PACK_NEXT(prev, next);
     
-    
+    /* If bp is not at the end of the list */
+    if (next != NULL)
+        PACK_PREV(next, prev);
+#endif
 }
     
 
+/*
+ * mm_check - Check the current arena's whole heap and free index in one
+ *     go: both walks start over and run to the end of a pass.
+ */
 static int mm_check(void) {
+    ar->chk.block = NULL;
+    ar->chk.list = -1;
+    return check_slice((size_t)-1);
+}
+
+/*
+ * The number of free lists the index walk goes through, the first node
+ * of one and the node after bp on it. The seglist policy's tree comes
+ * after its lists and is walked in order.
+ */
+#if FIT_POLICY == FIT_TLSF
+#define CHECK_LISTS (FL_COUNT * SL_COUNT)
+
+static char *check_first(int list) {
+    return ar->tlsf_lists[list / SL_COUNT][list % SL_COUNT];
+}
+
+static char *check_next(char *bp, int list) {
+    (void)list;
+    return GET_NEXT_FREE(bp);
+}
+#elif FIT_POLICY == FIT_ADDRORDER
+#define CHECK_LISTS 1
+
+static char *check_first(int list) {
+    (void)list;
+    return ar->skip_head_next[0];
+}
+
+static char *check_next(char *bp, int list) {
+    (void)list;
+    return skip_next(bp, 0);
+}
+#else
+#define CHECK_LISTS (NUM_CLASSES + 1)
+
+static char *check_first(int list) {
+    char *bp = ar->tree_root;
+    
+    if (list < NUM_CLASSES)
+        return ar->seg_lists[list];
+    while (bp != NULL && GET_LEFT(bp) != NULL)
+        bp = GET_LEFT(bp);
+    return bp;
+}
+
+static char *check_next(char *bp, int list) {
+    char *parent;
     
+    if (list < NUM_CLASSES)
+        return GET_NEXT_FREE(bp);
+    
+    /* In-order successor: the leftmost node on the right, or the first ancestor on the right */
+    if (GET_RIGHT(bp) != NULL) {
+        for (bp = GET_RIGHT(bp); GET_LEFT(bp) != NULL; bp = GET_LEFT(bp))
+            ;
+        return bp;
+    }
+    while ((parent = GET_PARENT(bp)) != NULL && GET_RIGHT(parent) == bp)
+        bp = parent;
+    return parent;
+}
+#endif
+
+/*
+ * check_slice - Advance the current arena's heap walk and index walk by
+ *     up to budget blocks and nodes between them, stopping either walk at
+ *     the end of a pass. A block or node too damaged to step past ends
+ *     its walk's pass early. Returns 1 if everything seen was consistent,
+ *     0 if not.
+ */
+static int check_slice(size_t budget) {
+    checker_t *c = &ar->chk;
+    size_t blocks = budget - budget / 2;
+    size_t nodes = budget / 2;
+    int ok = 1;
     char *bp;
-    int errno = 1;
     
-    // For each block in the heap
-    for (bp = heap_listp; GET_SIZE(HDRP(bp)) > 0; bp = NEXT_BLKP(bp)) {
-        //printf("%p: %d\n", bp, GET_SIZE(HDRP(bp)));
-        errno = checkBlockHFA(bp);
-        
-        /* If block is allocated, check that it does not overlap with the next block */
-        if (GET_ALLOC(HDRP(bp)))
-            errno = checkBlocksOverlap(bp);
-        
-        /* If block is free, check if the next block is free -> if so then bp escaped coalescing */
-        if (!GET_ALLOC(HDRP(bp)))
-            errno = checkBlockEscapedCoalesce(bp);
-        
+    if (ar->heap_listp == 0)
+        return 1;
+    
+    /* The heap walk, from the prologue to the epilogue */
+    if (c->block == NULL) {
+        c->block = ar->heap_listp;
+        c->block_count = c->block_bytes = 0;
+        c->block_start = c->changes;
     }
-    return errno;
+    for (; blocks > 0; blocks--) {
+        bp = c->block;
+        if (GET_SIZE(HDRP(bp)) == 0) {
+            if (HDRP(bp) != (char *)mem_arena_hi(ar->id) + 1 - WSIZE) {
+                printf("ERROR: Epilogue %p is not at the end of the heap\n", bp);
+                ok = 0;
+            }
+            else if (c->block_start == c->changes)
+                ok &= checkTotals(c->block_count, c->block_bytes, "heap walk");
+            c->block = NULL;
+            break;
+        }
+        if (!checkBlocksOverlap(bp)) {
+            c->block = NULL;
+            return 0;
+        }
+        ok &= checkBlockHFA(bp);
+        if (!GET_ALLOC(HDRP(bp))) {
+            ok &= checkBlockEscapedCoalesce(bp) & checkBlockLinked(bp);
+            c->block_count++;
+            c->block_bytes += GET_SIZE(HDRP(bp));
+        }
+        c->block = NEXT_BLKP(bp);
+    }
+    
+    /* The index walk, list by list */
+    if (c->list < 0) {
+        c->list = 0;
+        c->node = NULL;
+        c->node_count = c->node_bytes = 0;
+        c->node_start = c->changes;
+    }
+    for (; nodes > 0; nodes--) {
+        bp = (c->node != NULL) ? c->node : check_first(c->list);
+#if FIT_POLICY == FIT_TLSF
+        if (c->node == NULL && !(ar->sl_bitmap[c->list / SL_COUNT] >> (c->list % SL_COUNT) & 1) != (bp == NULL)) {
+            printf("ERROR: Bitmap disagrees with free list %d\n", c->list);
+            ok = 0;
+        }
+#endif
+        if (bp != NULL) {
+            if (!checkFreeNode(bp, c->list)) {
+                c->list = -1;
+                return 0;
+            }
+            c->node_count++;
+            c->node_bytes += GET_SIZE(HDRP(bp));
+            bp = check_next(bp, c->list);
+        }
+        c->node = bp;
+        if (bp == NULL && ++c->list == CHECK_LISTS) {
+            if (c->node_start == c->changes)
+                ok &= checkTotals(c->node_count, c->node_bytes, "free index");
+            c->list = -1;
+            break;
+        }
+    }
+    return ok;
 }
 
-/* Function to check that a block's header and footer match and that it is aligned */
+/*
+ * Function to check that a free block's header and footer match, that the
+ * next block's prev-alloc bit agrees with this block, and that it is aligned
+ */
 static int checkBlockHFA(void *bp) {
     int errno = 1;
     
-    /* Check header and footer match */
-    if (GET_SIZE(HDRP(bp)) != GET_SIZE(FTRP(bp))){
+    /* Check header and footer match -- only free blocks carry a footer */
+    if (!GET_ALLOC(HDRP(bp)) && GET_SIZE(HDRP(bp)) != GET_SIZE(FTRP(bp))){
         printf("ERROR: Size of header and footer do not match\n");
         errno = 0;
     }
     
-    if (GET_ALLOC(HDRP(bp)) != GET_ALLOC(FTRP(bp))){
+    if (!GET_ALLOC(HDRP(bp)) && GET_ALLOC(FTRP(bp))){
         printf("ERROR: Allocation status of header and footer do not match\n");
         errno = 0;
     }
     
-    /* Make sure payload is aligned */
-    if (ALIGN(GET_SIZE(HDRP(bp))) != GET_SIZE(HDRP(bp))) {
+    if (!GET_PREV_ALLOC(HDRP(NEXT_BLKP(bp))) != !GET_ALLOC(HDRP(bp))){
+        printf("ERROR: Prev-alloc bit of next block does not match\n");
+        errno = 0;
+    }
+    
+    /* Make sure payload is aligned -- the prologue is always DSIZE */
+    if (bp != ar->heap_listp && BLOCK_ROUND(GET_SIZE(HDRP(bp))) != GET_SIZE(HDRP(bp))) {
         printf("ERROR: Payload is not aligned\n");
         errno = 0;
     }
@@ -480,41 +3360,139 @@ static int checkBlockHFA(void *bp) {
     return errno;
 }
 
-/* Function to check if an allocated block overlaps with the block after it */
+/* Function to check that a block is big enough and ends inside the heap, so the next one can be read */
 static int checkBlocksOverlap(void *bp){
+    size_t size = GET_SIZE(HDRP(bp));
     
-    /* Check if the address of bp + the size of bp is greater than the address of the next block */
-    if (bp + GET_SIZE(HDRP(bp)) - WSIZE >= NEXT_BLKP(bp)) {
-        printf("ERROR: Block overlaps with next block\n");
+    if ((bp != ar->heap_listp && size < MIN_BLOCK_SIZE)
+        || HDRP(NEXT_BLKP(bp)) > (char *)mem_arena_hi(ar->id) + 1 - WSIZE) {
+        printf("ERROR: Block %p of %zu bytes overlaps the end of the heap\n", bp, size);
         return 0;
     }
-    
-    return -1;
+    return 1;
 }
 
+/* Function to check that a free block has no free block after it, which should have been coalesced */
 static int checkBlockEscapedCoalesce(void *bp){
-    
-    /* If bp is free, check if next block is also free */
-    if (!GET_ALLOC(HDRP(NEXT_BLKP(bp))))
-        printf("Block escaped coalescing\n");
+    if (!GET_ALLOC(HDRP(NEXT_BLKP(bp)))) {
+        printf("ERROR: Block %p escaped coalescing\n", bp);
         return 0;
-    return -1;
+    }
+    return 1;
 }
 
+/* Function to check that a free-index pointer lands on a payload inside the heap */
 static int checkBlockOutOfBounds(void *bp){
-    //printf("Heap Lo: %p -- Heap Hi: %p\n", mem_heap_lo(), mem_heap_hi());
-    char *heap_lo = mem_heap_lo();
-    char *heap_hi = mem_heap_hi();
+    if ((char *)bp > (char *)mem_arena_hi(ar->id) || (char *)bp < (char *)mem_arena_lo(ar->id) + DSIZE
+        || ((size_t)bp & (BLOCK_ALIGN-1)) != 0) {
+        printf("ERROR: Block %p out of bounds\n", bp);
+        return 0;
+    }
+    return 1;
+}
+
+/* Function to check that the heap walk's free block is linked into the free index where it belongs */
+static int checkBlockLinked(void *bp){
+#if FIT_POLICY == FIT_ADDRORDER
+    char *update[SKIP_LEVELS];
     
-    if (bp > mem_heap_hi() || bp < mem_heap_lo()) {
-        printf("Block %p out of bounds\n", bp);
+    skip_find(bp, update);
+    if (skip_next(update[0], 0) != bp) {
+        printf("ERROR: Free block %p is not in the skip list\n", bp);
         return 0;
     }
     return 1;
+#else
+    char *prev, *next;
     
+#if FIT_POLICY == FIT_SEGLIST
+    if (GET_SIZE(HDRP(bp)) >= TREE_MIN_SIZE) {
+        prev = GET_PARENT(bp);
+        if (prev == NULL ? ar->tree_root != bp
+            : !checkBlockOutOfBounds(prev) || (GET_LEFT(prev) != bp && GET_RIGHT(prev) != bp)) {
+            printf("ERROR: Free block %p is not in the tree\n", bp);
+            return 0;
+        }
+        return 1;
+    }
+#endif
+    prev = GET_PREV_FREE(bp);
+    next = GET_NEXT_FREE(bp);
+    if ((prev == NULL ? *list_head(GET_SIZE(HDRP(bp))) != bp
+         : !checkBlockOutOfBounds(prev) || GET_NEXT_FREE(prev) != bp)
+        || (next != NULL && (!checkBlockOutOfBounds(next) || GET_PREV_FREE(next) != bp))) {
+        printf("ERROR: Free block %p is not linked into its free list\n", bp);
+        return 0;
+    }
+    return 1;
+#endif
 }
+
+/* Function to check that a node of the index walk is a free block on the right list */
+static int checkFreeNode(void *bp, int list){
+    size_t size;
+    char *next;
+    
+    if (!checkBlockOutOfBounds(bp))
+        return 0;
+    size = GET_SIZE(HDRP(bp));
+    if (GET_ALLOC(HDRP(bp)) || size < MIN_BLOCK_SIZE
+        || FTRP(bp) > (char *)mem_arena_hi(ar->id) + 1 - WSIZE || GET(FTRP(bp)) != size) {
+        printf("ERROR: Free-index node %p is not a free block\n", bp);
+        return 0;
+    }
+    
+#if FIT_POLICY == FIT_ADDRORDER
+    (void)list;
+    next = skip_next(bp, 0);
+    if (next != NULL && (!checkBlockOutOfBounds(next) || next <= (char *)bp + size)) {
+        printf("ERROR: Skip-list node %p is out of address order\n", bp);
+        return 0;
+    }
+#else
+#if FIT_POLICY == FIT_SEGLIST
+    if (list == NUM_CLASSES) {
+        char *left = GET_LEFT(bp);
+        char *right = GET_RIGHT(bp);
         
-        
+        if (size < TREE_MIN_SIZE
+            || (left != NULL && (!checkBlockOutOfBounds(left) || GET_PARENT(left) != bp || !tree_less(left, bp)))
+            || (right != NULL && (!checkBlockOutOfBounds(right) || GET_PARENT(right) != bp || !tree_less(bp, right)))) {
+            printf("ERROR: Tree node %p is out of order\n", bp);
+            return 0;
+        }
+        return 1;
+    }
+    if (size >= TREE_MIN_SIZE || size_class(size) != list) {
+#else
+    int fl, sl;
     
+    tlsf_mapping(size, &fl, &sl);
+    if (fl * SL_COUNT + sl != list) {
+#endif
+        printf("ERROR: Free block %p of %zu bytes is on list %d\n", bp, size, list);
+        return 0;
+    }
+    next = GET_NEXT_FREE(bp);
+    if (next != NULL && (!checkBlockOutOfBounds(next) || GET_PREV_FREE(next) != bp)) {
+        printf("ERROR: Free list %d is broken after %p\n", list, bp);
+        return 0;
+    }
+#endif
+    return 1;
+}
 
-
+/* Function to check a pass's free-block totals, when nothing changed during it, against the counters */
+static int checkTotals(size_t count, size_t bytes, const char *walk){
+    size_t expect = 0;
+    int k;
+    
+    for (k = 0; k < MM_STATS_CLASSES; k++)
+        expect += ar->ctr.free_count[k];
+    if (count != expect || bytes != ar->ctr.free_bytes) {
+        printf("ERROR: The %s found %zu free blocks of %zu bytes, the counters say %zu of %zu\n",
+               walk, count, bytes, expect, ar->ctr.free_bytes);
+        return 0;
+    }
+    return 1;
+}
@@ -3,7 +3,81 @@
 extern int mm_init (void);
 extern void *mm_malloc (size_t size);
 extern void mm_free (void *ptr);
+extern void mm_free_sized(void *ptr, size_t size);
+extern size_t mm_usable_size(void *ptr);
 extern void *mm_realloc(void *ptr, size_t size);
+extern void *mm_calloc(size_t nmemb, size_t size);
+extern void *mm_memalign(size_t alignment, size_t size);
+extern void *mm_aligned_alloc(size_t alignment, size_t size);
+extern void mm_fork_prepare(void);
+extern void mm_fork_parent(void);
+extern void mm_fork_child(void);
+extern size_t mm_malloc_batch(size_t size, size_t n, void **out);
+extern void mm_free_batch(void **ptrs, size_t n);
+
+/* A region frees everything allocated from it at once */
+typedef struct mm_region mm_region_t;
+
+extern mm_region_t *mm_region_create(void);
+extern void *mm_region_alloc(mm_region_t *r, size_t size);
+extern void mm_region_reset(mm_region_t *r);
+extern void mm_region_destroy(mm_region_t *r);
+
+/* A pool hands out objects of one fixed size */
+typedef struct mm_pool mm_pool_t;
+
+extern mm_pool_t *mm_pool_create(size_t objsize);
+extern void *mm_pool_get(mm_pool_t *p);
+extern void mm_pool_put(mm_pool_t *p, void *obj);
+extern void mm_pool_destroy(mm_pool_t *p);
+
+/* Counters for one arena, filled in by mm_arena_stats */
+typedef struct {
+    size_t heapsize;    /* bytes of the arena's region in use */
+    size_t mallocs;     /* requests the arena's heap served */
+    size_t frees;       /* blocks freed back to the arena's heap */
+    size_t contended;   /* lock acquisitions that found the lock taken */
+    size_t remote_frees; /* frees other threads queued on the arena */
+    int threads;        /* threads assigned to the arena */
+} mm_arena_stats_t;
+
+extern int mm_arena_count(void);
+extern int mm_arena_stats(int arena, mm_arena_stats_t *stats);
+
+/*
+ * Heap counters, summed over every arena and filled in by mm_stats.
+ * Free blocks are counted by power-of-two size class: class k holds
+ * blocks of [2^(k+4), 2^(k+5)) bytes, and the last class everything
+ * bigger.
+ */
+#define MM_STATS_CLASSES 20
+
+typedef struct {
+    size_t live_bytes;      /* bytes in allocated heap blocks and mappings */
+    size_t free_bytes;      /* bytes in free heap blocks */
+    size_t free_blocks[MM_STATS_CLASSES]; /* free heap blocks per class */
+    size_t largest_free;    /* size of the biggest free heap block */
+    size_t sbrk_calls;      /* mem_sbrk calls, growing or trimming */
+    size_t coalesce[4];     /* frees that merged with neither, the next, the previous or both neighbours */
+    size_t fit_searches;    /* free-block searches */
+    size_t fit_probes;      /* free blocks the searches looked at */
+} mm_stats_t;
+
+extern void mm_stats(mm_stats_t *stats);
+
+/* Check the next budget blocks and free-list nodes of the heap */
+extern int mm_check_slice(size_t budget);
+
+/* Lock counters for one size-class bin, filled in by mm_bin_stats */
+typedef struct {
+    size_t objsize;     /* size of the bin's objects */
+    size_t acquires;    /* times the bin's lock was taken */
+    size_t spins;       /* trylocks that found it taken */
+    size_t sleeps;      /* acquisitions that stopped spinning and blocked */
+} mm_bin_stats_t;
+
+extern int mm_bin_count(void);
+extern int mm_bin_stats(int bin, mm_bin_stats_t *stats);
 
 
 /* 
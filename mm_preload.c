@@ -0,0 +1,145 @@
+/*
+ * mm_preload.c - Exports mm.c as the process's malloc, for running real
+ *     programs on the allocator:
+ *
+ *         make libmm.so
+ *         LD_PRELOAD=./libmm.so some-program
+ *
+ * libmm.so is built thread-safe, with memlib's MEM_NATIVE heap (real
+ * pages, grown and trimmed on demand) and 16-byte blocks, the alignment
+ * glibc's malloc gives. Requests of 8 bytes or less still come from
+ * 8-byte slab slots, which is all the alignment an object that small
+ * can need. The heap is a MAX_HEAP reservation, but only the brk heap is
+ * held to it: requests too big for it get mappings of their own.
+ *
+ * The package sets itself up on the first call, which can come from
+ * inside the dynamic loader or libc before any constructor has run, so
+ * nothing on that path may allocate. It registers pthread_atfork
+ * handlers at the same time, so a child forked while another thread is
+ * inside the allocator does not inherit a held lock.
+ */
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "mm.h"
+#include "memlib.h"
+
+#define EXPORT __attribute__((visibility("default")))
+
+static volatile int ready;      /* set once mem_init and mm_init have run */
+static pthread_mutex_t init_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Set the package up on the first call into it */
+static void preload_init(void)
+{
+    if (__atomic_load_n(&ready, __ATOMIC_ACQUIRE))
+        return;
+    pthread_mutex_lock(&init_lock);
+    if (!ready) {
+        mem_init();
+        if (mm_init() < 0)
+            abort();
+        pthread_atfork(mm_fork_prepare, mm_fork_parent, mm_fork_child);
+        __atomic_store_n(&ready, 1, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&init_lock);
+}
+
+EXPORT void *malloc(size_t size)
+{
+    void *p;
+
+    preload_init();
+    if ((p = mm_malloc(size ? size : 1)) == NULL)
+        errno = ENOMEM;
+    return p;
+}
+
+EXPORT void free(void *ptr)
+{
+    if (ptr != NULL)
+        mm_free(ptr);
+}
+
+EXPORT void *calloc(size_t nmemb, size_t size)
+{
+    void *p;
+
+    preload_init();
+    if (nmemb == 0 || size == 0)
+        nmemb = size = 1;
+    if ((p = mm_calloc(nmemb, size)) == NULL)
+        errno = ENOMEM;
+    return p;
+}
+
+EXPORT void *realloc(void *ptr, size_t size)
+{
+    void *p;
+
+    preload_init();
+    if (ptr == NULL)
+        size = size ? size : 1;
+    if ((p = mm_realloc(ptr, size)) == NULL && size != 0)
+        errno = ENOMEM;
+    return p;
+}
+
+EXPORT void *memalign(size_t alignment, size_t size)
+{
+    void *p;
+
+    preload_init();
+    if (alignment == 0 || (alignment & (alignment - 1)) != 0) {
+        errno = EINVAL;
+        return NULL;
+    }
+    if ((p = mm_memalign(alignment, size ? size : 1)) == NULL)
+        errno = ENOMEM;
+    return p;
+}
+
+EXPORT void *aligned_alloc(size_t alignment, size_t size)
+{
+    return memalign(alignment, size);
+}
+
+EXPORT int posix_memalign(void **memptr, size_t alignment, size_t size)
+{
+    void *p;
+    int saved = errno;
+
+    if (alignment < sizeof(void *) || (alignment & (alignment - 1)) != 0)
+        return EINVAL;
+    if ((p = memalign(alignment, size)) == NULL) {
+        errno = saved;
+        return ENOMEM;
+    }
+    *memptr = p;
+    return 0;
+}
+
+EXPORT void *valloc(size_t size)
+{
+    return memalign(mem_pagesize(), size);
+}
+
+EXPORT void *pvalloc(size_t size)
+{
+    size_t pagesize = mem_pagesize();
+
+    if (size > (size_t)-1 - (pagesize - 1)) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    return memalign(pagesize, (size + pagesize - 1) & ~(pagesize - 1));
+}
+
+EXPORT size_t malloc_usable_size(void *ptr)
+{
+    return mm_usable_size(ptr);
+}